@@ -1,4 +1,8 @@
+#include "core/evaluator/libtorch_quantized.h"
+#include "core/evaluator/libtorch_queued.h"
+#include "core/evaluator/native.h"
 #include "core/evaluator/libtorch_simple.h"
+#include "core/evaluator/onnx_queued.h"
 #include "core/evaluator/onnx_simple.h"
 #include "game/shadow.h"
 
@@ -28,26 +32,73 @@ void run_onnx(const std::string& model, int num) {
   std::cout << "result = " << result << std::endl;
 }
 
+// each evaluateN call of a queued evaluator is run as one batch of batch_size.
+void run_batched(EvaluatorBase& evaluator, int num, int batch_size) {
+  auto game = Shadow::GameState();
+  auto result = 0.0;
+  std::vector<std::function<void(float*)>> canonicalizes(
+      batch_size, std::bind(&Shadow::GameState::Canonicalize, &game, std::placeholders::_1));
+  std::vector<std::function<void(const float*, const float*)>> process_results(
+      batch_size, [&result](const float* pi, const float* v) { result += pi[0] + v[0]; });
+  std::vector<CanonicalizeFn> canonicalize_fns(canonicalizes.begin(), canonicalizes.end());
+  std::vector<ProcessResultFn> process_result_fns(process_results.begin(), process_results.end());
+  for (int i = 0; i < num; i += batch_size) {
+    evaluator.evaluateN(batch_size, canonicalize_fns.data(), process_result_fns.data(), nullptr, nullptr);
+  }
+  std::cout << "result = " << result << std::endl;
+}
+
+template <class Fn>
+void timed(const char* name, int num, Fn fn) {
+  auto start = high_resolution_clock::now();
+  fn();
+  auto end = high_resolution_clock::now();
+  auto duration = duration_cast<milliseconds>(end - start).count();
+  std::cout << "Time for " << name << ": " << duration << "ms\nIteration: " << num << std::endl;
+}
+
 int main(int argc, const char** argv) {
   int NumIterations = 10000;
-  if (argc == 3 && strcmp(argv[1], "-i") == 0) {
-    NumIterations = std::atoi(argv[2]);
+  int BatchSize = 1;
+  const char* QuantizedModel = nullptr;
+  const char* NativeWeights = nullptr;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-i") == 0) {
+      NumIterations = std::atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-b") == 0) {
+      BatchSize = std::atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-q") == 0) {
+      QuantizedModel = argv[i + 1];
+    } else if (strcmp(argv[i], "-n") == 0) {
+      NativeWeights = argv[i + 1];
+    }
   }
 
-  {
-    auto start = high_resolution_clock::now();
-    run_onnx("testdata/example.onnx", NumIterations);
-    auto end = high_resolution_clock::now();
-    auto duration = duration_cast<milliseconds>(end - start).count();
-    std::cout << "Time for onnx: " << duration << "ms\nIteration: " << NumIterations << std::endl;
+  if (BatchSize == 1) {
+    timed("onnx", NumIterations, [&]() { run_onnx("testdata/example.onnx", NumIterations); });
+    timed("libtorch", NumIterations, [&]() { run_libtorch("testdata/example.pt", NumIterations); });
+    return 0;
   }
 
+  // compare both backends on the cpu, with the same batches.
+  {
+    QueuedOnnxEvaluator evaluator("testdata/example.onnx", Shadow::CANONICAL_SHAPE, Shadow::NUM_ACTIONS,
+                                  /*cpu_only=*/true);
+    timed("queued onnx", NumIterations, [&]() { run_batched(evaluator, NumIterations, BatchSize); });
+  }
   {
-    auto start = high_resolution_clock::now();
-    run_libtorch("testdata/example.pt", NumIterations);
-    auto end = high_resolution_clock::now();
-    auto duration = duration_cast<milliseconds>(end - start).count();
-    std::cout << "Time for libtorch: " << duration << "ms\nIteration: " << NumIterations << std::endl;
+    QueuedLibtorchEvaluator evaluator("testdata/example.pt", Shadow::CANONICAL_SHAPE, /*cpu_only=*/true);
+    timed("queued libtorch", NumIterations, [&]() { run_batched(evaluator, NumIterations, BatchSize); });
+  }
+  // int8 model exported by python/quantize.py from the same network.
+  if (QuantizedModel) {
+    QuantizedLibtorchEvaluator evaluator(QuantizedModel, Shadow::CANONICAL_SHAPE);
+    timed("quantized libtorch", NumIterations, [&]() { run_batched(evaluator, NumIterations, BatchSize); });
+  }
+  // weights exported by python/export_native.py from the same network.
+  if (NativeWeights) {
+    NativeEvaluator<native::ShadowNNArch> evaluator(NativeWeights);
+    timed("native", NumIterations, [&]() { run_batched(evaluator, NumIterations, BatchSize); });
   }
   return 0;
 }
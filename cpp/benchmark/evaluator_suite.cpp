@@ -0,0 +1,260 @@
+#include <sys/resource.h>
+
+#include "core/evaluator/libtorch_quantized.h"
+#include "core/evaluator/libtorch_queued.h"
+#include "core/evaluator/libtorch_simple.h"
+#include "core/evaluator/native.h"
+#ifdef USE_ONNX
+#include "core/evaluator/onnx_queued.h"
+#include "core/evaluator/onnx_simple.h"
+#endif
+#include "game/shadow.h"
+
+#include "core/util/argh.h"
+
+// Sweeps evaluator backends x batch sizes x caller threads. Every caller thread
+// evaluates batches of positions back to back for a fixed time, one JSON object
+// per configuration is printed on stdout:
+//   {"backend": ..., "batch_size": ..., "threads": ..., "in_flight": ..., "positions_per_second": ...,
+//    "p50_ms": ..., "p95_ms": ..., "p99_ms": ..., "cpu_cores": ..., "cpu_utilization": ...}
+// Latencies are per evaluate/evaluateN call, cpu_cores is the process cpu time over
+// the wall time, cpu_utilization divides it by the hardware threads.
+// With --in-flight n, every caller thread keeps n calls submitted (submit() and
+// wait_any()) instead of blocking on one, latencies are then from submit to result.
+//
+// Usage: benchmark_evaluator_suite [--backends a,b] [--batch-sizes 1,8,64] [--threads 1,8,32]
+//          [--seconds 3] [--cpu] [--model testdata/example.pt] [--onnx-model testdata/example.onnx]
+//          [--quantized-model <file>] [--native-weights <file>] [--in-flight 1]
+// Backends: libtorch, queued_libtorch, onnx, queued_onnx, quantized, native (the last
+// two only when their model is given). The simple backends run batches one by one.
+
+constexpr int POSITION_COUNT = 256;
+
+using Game = Shadow::GameState;
+
+std::vector<int> parse_list(const std::string& str) {
+  std::vector<int> values;
+  std::stringstream ss(str);
+  for (std::string item; std::getline(ss, item, ',');) values.push_back(std::stoi(item));
+  return values;
+}
+
+std::vector<std::string> parse_names(const std::string& str) {
+  std::vector<std::string> names;
+  std::stringstream ss(str);
+  for (std::string item; std::getline(ss, item, ',');) names.push_back(item);
+  return names;
+}
+
+// positions of random games, so inputs and legal moves vary like in a real search.
+std::vector<Game> random_positions(int count) {
+  std::mt19937 gen(42);
+  std::vector<Game> positions;
+  Game game;
+  while ((int)positions.size() < count) {
+    std::vector<int> moves;
+    auto valid_moves = game.Valid_moves();
+    for (int i = 0; i < Shadow::NUM_ACTIONS; i++) {
+      if (valid_moves[i]) moves.push_back(i);
+    }
+    if (game.End() || moves.empty()) {
+      game = Game();
+      continue;
+    }
+    positions.push_back(game);
+    game.Move(moves[gen() % moves.size()]);
+  }
+  return positions;
+}
+
+double process_cpu_seconds() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// the requests of one call.
+struct Call {
+  std::vector<std::function<void(float*)>> canonicalizes;
+  std::vector<std::function<void(const float*, const float*)>> process_results;
+  std::vector<std::span<const int>> legal;
+  std::vector<CanonicalizeFn> canonicalize_fns;
+  std::vector<ProcessResultFn> process_result_fns;
+  Ticket ticket;
+  high_resolution_clock::time_point start;
+
+  explicit Call(int batch_size)
+      : canonicalizes(batch_size),
+        process_results(batch_size),
+        legal(batch_size),
+        canonicalize_fns(canonicalizes.begin(), canonicalizes.end()),
+        process_result_fns(process_results.begin(), process_results.end()) {}
+};
+
+struct Result {
+  double positions_per_second, p50_ms, p95_ms, p99_ms, cpu_cores, cpu_utilization;
+};
+
+// every thread runs calls of batch_size positions until the time is over, in_flight at a time.
+Result run(EvaluatorBase& evaluator, const std::vector<Game>& positions,
+           const std::vector<std::vector<int>>& legal_moves, int batch_size, int thread_count, int in_flight,
+           std::chrono::duration<double> duration) {
+  std::atomic<bool> stop = false;
+  std::vector<std::vector<int64_t>> latencies(thread_count);
+  std::vector<int64_t> items(thread_count);
+  std::atomic<double> sink = 0;
+
+  auto work = [&](int t) {
+    double sum = 0;
+    int k = t * batch_size;
+    auto prepare = [&](Call& call) {
+      for (int i = 0; i < batch_size; i++) {
+        int p = (k + i) % positions.size();
+        call.canonicalizes[i] = [&positions, p](float* input) { positions[p].Canonicalize(input); };
+        call.process_results[i] = [&sum](const float*, const float* v) { sum += v[0]; };
+        call.legal[i] = legal_moves[p];
+      }
+      k += thread_count * batch_size;
+      call.start = high_resolution_clock::now();
+    };
+    auto finish = [&](Call& call) {
+      latencies[t].push_back((high_resolution_clock::now() - call.start).count());
+      items[t] += batch_size;
+    };
+
+    // built in place, the function references point into each call.
+    std::vector<Call> calls;
+    calls.reserve(in_flight);
+    for (int i = 0; i < in_flight; i++) calls.emplace_back(batch_size);
+    if (in_flight == 1) {
+      auto& call = calls[0];
+      while (!stop) {
+        prepare(call);
+        if (batch_size == 1) {
+          evaluator.evaluate(call.canonicalizes[0], call.process_results[0], 0, call.legal[0]);
+        } else {
+          evaluator.evaluateN(batch_size, call.canonicalize_fns.data(), call.process_result_fns.data(), nullptr,
+                              call.legal.data());
+        }
+        finish(call);
+      }
+    } else {
+      auto submit = [&](Call& call) {
+        prepare(call);
+        evaluator.submit(call.ticket, batch_size, call.canonicalize_fns.data(), call.process_result_fns.data(),
+                         nullptr, call.legal.data());
+      };
+      std::vector<Ticket*> tickets;
+      for (auto& call : calls) {
+        submit(call);
+        tickets.push_back(&call.ticket);
+      }
+      while (!stop) {
+        auto& call = calls[evaluator.wait_any(tickets)];
+        finish(call);
+        submit(call);
+      }
+      for (auto* ticket : tickets) evaluator.wait(*ticket);
+    }
+    sink = sink + sum;
+  };
+
+  auto start = high_resolution_clock::now();
+  double cpu_start = process_cpu_seconds();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; t++) threads.emplace_back(work, t);
+  std::this_thread::sleep_for(duration);
+  stop = true;
+  for (auto& thread : threads) thread.join();
+  double wall = std::chrono::duration<double>(high_resolution_clock::now() - start).count();
+  double cpu = process_cpu_seconds() - cpu_start;
+
+  std::vector<int64_t> all;
+  int64_t total_items = 0;
+  for (int t = 0; t < thread_count; t++) {
+    all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    total_items += items[t];
+  }
+  std::sort(all.begin(), all.end());
+  auto percentile_ms = [&](double q) {
+    using ns = high_resolution_clock::duration;
+    return all.empty() ? 0.0
+                       : std::chrono::duration<double, std::milli>(ns(all[(size_t)(q * (all.size() - 1))])).count();
+  };
+  double cores = cpu / wall;
+  return {total_items / wall, percentile_ms(0.50), percentile_ms(0.95), percentile_ms(0.99), cores,
+          cores / std::max(1u, std::thread::hardware_concurrency())};
+}
+
+int main(int argc, const char** argv) {
+  argh::parser cmd({"--backends", "--batch-sizes", "--threads", "--seconds", "--model", "--onnx-model",
+                    "--quantized-model", "--native-weights", "--in-flight"});
+  cmd.parse(argc, argv);
+  auto backends = parse_names(cmd("--backends", "libtorch,queued_libtorch,onnx,queued_onnx,quantized,native").str());
+  auto batch_sizes = parse_list(cmd("--batch-sizes", "1,8,64").str());
+  auto thread_counts = parse_list(cmd("--threads", "1,8,32").str());
+  double seconds;
+  cmd("--seconds", 3.0) >> seconds;
+  bool cpu_only = cmd["--cpu"];
+  int in_flight;
+  cmd("--in-flight", 1) >> in_flight;
+  auto model = cmd("--model", "testdata/example.pt").str();
+  auto onnx_model = cmd("--onnx-model", "testdata/example.onnx").str();
+  auto quantized_model = cmd("--quantized-model").str();
+  auto native_weights = cmd("--native-weights").str();
+
+  auto positions = random_positions(POSITION_COUNT);
+  std::vector<std::vector<int>> legal_moves;
+  for (const auto& game : positions) {
+    auto valid_moves = game.Valid_moves();
+    legal_moves.emplace_back();
+    for (int i = 0; i < Shadow::NUM_ACTIONS; i++) {
+      if (valid_moves[i]) legal_moves.back().push_back(i);
+    }
+  }
+
+  c10::InferenceMode guard;
+  for (const auto& backend : backends) {
+    // shared_ptr deletes through the concrete type.
+    std::shared_ptr<EvaluatorBase> evaluator;
+    if (backend == "libtorch") {
+      evaluator = std::make_shared<LibtorchEvaluator>(model, Shadow::CANONICAL_SHAPE, cpu_only, true, false);
+    } else if (backend == "queued_libtorch") {
+      evaluator = std::make_shared<QueuedLibtorchEvaluator>(model, Shadow::CANONICAL_SHAPE, cpu_only, 0, true, false);
+    } else if (backend == "quantized" && !quantized_model.empty()) {
+      evaluator = std::make_shared<QuantizedLibtorchEvaluator>(quantized_model, Shadow::CANONICAL_SHAPE, true, false);
+    } else if (backend == "native" && !native_weights.empty()) {
+      evaluator = std::make_shared<NativeEvaluator<native::ShadowNNArch>>(native_weights, true, false);
+#ifdef USE_ONNX
+    } else if (backend == "onnx") {
+      evaluator = std::make_shared<OnnxEvaluator>(onnx_model, Shadow::CANONICAL_SHAPE, Shadow::NUM_ACTIONS, cpu_only,
+                                                  0, true, false);
+    } else if (backend == "queued_onnx") {
+      evaluator = std::make_shared<QueuedOnnxEvaluator>(onnx_model, Shadow::CANONICAL_SHAPE, Shadow::NUM_ACTIONS,
+                                                        cpu_only, 0, true, false);
+#endif
+    } else {
+      std::cerr << "Skipping backend " << backend << ": not available." << std::endl;
+      continue;
+    }
+
+    for (int batch_size : batch_sizes) {
+      for (int thread_count : thread_counts) {
+        // first calls of a shape are not measured.
+        run(*evaluator, positions, legal_moves, batch_size, thread_count, in_flight,
+            std::chrono::duration<double>(0.5));
+        auto result = run(*evaluator, positions, legal_moves, batch_size, thread_count, in_flight,
+                          std::chrono::duration<double>(seconds));
+        std::cout << std::format(
+                         "{{\"backend\": \"{}\", \"batch_size\": {}, \"threads\": {}, \"in_flight\": {}, "
+                         "\"positions_per_second\": {:.1f}, \"p50_ms\": {:.3f}, \"p95_ms\": {:.3f}, "
+                         "\"p99_ms\": {:.3f}, \"cpu_cores\": {:.2f}, "
+                         "\"cpu_utilization\": {:.3f}}}",
+                         backend, batch_size, thread_count, in_flight, result.positions_per_second,
+                         result.p50_ms, result.p95_ms, result.p99_ms, result.cpu_cores, result.cpu_utilization)
+                  << std::endl;
+      }
+    }
+  }
+  return 0;
+}
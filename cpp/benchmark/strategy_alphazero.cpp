@@ -1,26 +1,85 @@
 #include "core/algorithm/strategy_alphazero.h"
 
 #include "core/evaluator/dummy.h"
+#include "core/evaluator/mock.h"
+#include "core/evaluator/replay.h"
 #include "game/shadow.h"
 
+#include "core/util/argh.h"
+
+// Usage: benchmark_alphazero [-i iterations] [-g games]
+//          [--mock batch_us,item_us,max_batch] [--pseudo-policy]
+//          [--replay recording] [--symmetry-folding] [--prefetch count]
+// Without --mock, positions are evaluated by DummyEvaluator at no cost. With it,
+// by a MockEvaluator simulating a network of that latency, shared by the games
+// searched concurrently, one thread each.
+// --replay serves the network outputs recorded by selfplay_shadow --record, the
+// positions missing from it go to the evaluator above. Selfplay records with
+// symmetry folding, use --symmetry-folding for its position hashes.
+// --prefetch lets searches add up to count speculative evaluations to each
+// request, the mock runs batches up to count + 1 positions at the cost of one.
 int main(int argc, const char** argv) {
-  int NumIterations = 100000;
-  if (argc == 3 && strcmp(argv[1], "-i") == 0) {
-    NumIterations = std::atoi(argv[2]);
-  }
+  argh::parser cmd({"-i", "-g", "--mock", "--replay", "--prefetch"});
+  cmd.parse(argc, argv);
+  int NumIterations, NumGames;
+  cmd("-i", 100000) >> NumIterations;
+  cmd("-g", 1) >> NumGames;
+  auto mock = cmd("--mock").str();
+  auto replay = cmd("--replay").str();
+  int prefetch;
+  cmd("--prefetch", 0) >> prefetch;
 
-  alphazero::Algorithm<Shadow::GameState, 0> algorithm;
-  auto evaluator = DummyEvaluator(Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS);
+  alphazero::Algorithm<Shadow::GameState, 0> algorithm(alphazero::CPUCT, alphazero::FPU_REDUCTION,
+                                                       cmd["--symmetry-folding"], prefetch);
+  std::unique_ptr<DummyEvaluator> dummy;
+  std::unique_ptr<MockEvaluator> mock_evaluator;
+  EvaluatorBase* evaluator;
+  if (mock.empty()) {
+    dummy = std::make_unique<DummyEvaluator>(Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS);
+    evaluator = dummy.get();
+  } else {
+    int batch_us = 0, item_us = 0, max_batch = 256;
+    std::sscanf(mock.c_str(), "%d,%d,%d", &batch_us, &item_us, &max_batch);
+    mock_evaluator = std::make_unique<MockEvaluator>(Shadow::CANONICAL_SHAPE, Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS,
+                                                     batch_us, item_us, max_batch, cmd["--pseudo-policy"]);
+    mock_evaluator->set_free_batch_size(prefetch + 1);
+    evaluator = mock_evaluator.get();
+  }
+  std::unique_ptr<ReplayEvaluator> replay_evaluator;
+  if (!replay.empty()) {
+    replay_evaluator = std::make_unique<ReplayEvaluator>(replay, evaluator);
+    evaluator = replay_evaluator.get();
+  }
   auto game = Shadow::GameState();
-  auto context = algorithm.compute(game, evaluator);
 
   auto start = high_resolution_clock::now();
-  context->step(/*iterations=*/NumIterations);
-  auto best_move = context->best_move();
-  auto best_value = context->best_value();
+  std::vector<std::unique_ptr<alphazero::Algorithm<Shadow::GameState, 0>::Context>> contexts;
+  for (int i = 0; i < NumGames; i++) contexts.push_back(algorithm.compute(game, *evaluator));
+  std::vector<std::thread> threads;
+  for (auto& context : contexts) {
+    threads.emplace_back([&context, NumIterations]() { context->step(/*iterations=*/NumIterations); });
+  }
+  for (auto& thread : threads) thread.join();
+  auto best_move = contexts[0]->best_move();
+  auto best_value = contexts[0]->best_value();
   auto end = high_resolution_clock::now();
   auto duration = duration_cast<milliseconds>(end - start).count();
-  std::cout << "Time: " << duration << "ms\nIteration: " << NumIterations
+  std::cout << "Time: " << duration << "ms\nIteration: " << NumIterations << " x " << NumGames
+            << "\nPlayouts/s: " << (int64_t)NumIterations * NumGames * 1000 / std::max<int64_t>(1, duration)
             << "\nBest move: " << game.action_to_string(best_move) << "\nBest value: " << best_value << std::endl;
+  if (mock_evaluator) {
+    std::cout << "Evaluator: " << mock_evaluator->statistics() << std::endl;
+  }
+  if (prefetch > 0) {
+    int64_t requests = 0, hits = 0;
+    for (auto& context : contexts) {
+      requests += context->prefetch_requests;
+      hits += context->prefetch_hits;
+    }
+    std::cout << "Prefetch: " << hits << "/" << requests << " speculative evaluations used" << std::endl;
+  }
+  if (replay_evaluator) {
+    std::cout << "Replay: " << replay_evaluator->stats().to_string() << std::endl;
+  }
   return 0;
 }
@@ -1,11 +1,26 @@
 #include "core/algorithm/strategy_alphazero.h"
 #include "core/evaluator/libtorch_queued.h"
+#include "core/evaluator/remote_client.h"
+#include "core/util/argh.h"
 #include "core/util/io.h"
 #include "game/shadow.h"
 
-void interactive(const char* model) {
+// Usage: game_shadow [model] [-r host:port]
+// With --remote, the model is evaluated by the inference server (serve_shadow --tcp)
+// at interactive priority, ahead of the selfplay batches sharing it.
+void interactive(const std::string& model, const std::string& remote) {
   alphazero::Algorithm<Shadow::GameState, 3> algorithm;
-  QueuedLibtorchEvaluator evaluator(model, Shadow::CANONICAL_SHAPE);
+  std::unique_ptr<RemoteEvaluator> remote_evaluator;
+  std::unique_ptr<QueuedLibtorchEvaluator> local_evaluator;
+  if (!remote.empty()) {
+    auto colon = remote.rfind(':');
+    remote_evaluator = std::make_unique<RemoteEvaluator>(
+        remote.substr(0, colon), std::stoi(remote.substr(colon + 1)), std::filesystem::path(model).filename().string(),
+        Shadow::CANONICAL_SHAPE, Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS, kInteractive);
+  } else {
+    local_evaluator = std::make_unique<QueuedLibtorchEvaluator>(model, Shadow::CANONICAL_SHAPE);
+  }
+  EvaluatorBase& evaluator = remote_evaluator ? (EvaluatorBase&)*remote_evaluator : *local_evaluator;
   auto game = std::make_shared<Shadow::GameState>();
 
   std::vector<std::shared_ptr<Shadow::GameState>> history;
@@ -73,10 +88,8 @@ void interactive(const char* model) {
 }
 
 int main(int argc, const char** argv) {
-  if (argc >= 2) {
-    interactive(argv[1]);
-  } else {
-    interactive("");
-  }
+  argh::parser cmd({"-r", "--remote"});
+  cmd.parse(argc, argv);
+  interactive(cmd(1).str(), cmd({"-r", "--remote"}).str());
   return 0;
 }
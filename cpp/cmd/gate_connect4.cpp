@@ -65,6 +65,12 @@ int main(int argc, const char** argv) {
   evaluator[1] = new QueuedLibtorchEvaluator(model_right, Connect4::CANONICAL_SHAPE,
                                              /*use_cpu_only=*/false,
                                              /*device_id=*/USE_TWO_GPU ? 1 : 0);
+  // on one device, the two models take turns instead of interleaving small batches.
+  DeviceScheduler scheduler;
+  if (!USE_TWO_GPU) {
+    evaluator[0]->share_device(scheduler);
+    evaluator[1]->share_device(scheduler);
+  }
 
   float win_count[2] = {0};
   float total_score[2][2] = {0};
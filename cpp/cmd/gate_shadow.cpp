@@ -1,5 +1,8 @@
 #include "core/algorithm/strategy_alphazero.h"
 #include "core/evaluator/libtorch_queued.h"
+#include "core/evaluator/pool.h"
+#include "core/evaluator/shm_client.h"
+#include "core/util/argh.h"
 #include "core/util/io.h"
 #include "game/shadow.h"
 
@@ -18,53 +21,73 @@ int main(int argc, const char** argv) {
   bool OUTPUT_BEST = false;
   bool OUTPUT_DATA = false;
   bool USE_TWO_GPU = false;
+  bool USE_SERVER = false;
   int THREAD_COUNT = 32;
   std::string OUTPUT_BEST_FILE = "best_model.txt";
   std::string OUTPUT_DATA_FILE = "gating_data.txt";
 
-  if (argc < 3) {
-    std::cout << "Usage: " << argv[0] << " <number_iteration> <model1> <model2>" << std::endl;
+  argh::parser cmd({"--output-best", "--output-data"});
+  cmd.parse(argc, argv);
+  if (cmd.size() < 4) {
+    std::cout << "Usage: " << argv[0] << " <number_iteration> <model1> <model2> [--show-board]"
+              << " [--output-best [file]] [--output-data [file]] [--server]" << std::endl;
     return 1;
   }
 
-  int GATING_TOTAL_ROUND = std::stoi(argv[1]);
+  int GATING_TOTAL_ROUND = std::stoi(cmd[1]);
   int GATING_AT_LEAST_WIN = (GATING_TOTAL_ROUND + 1) / 2;
 
-  auto model_left = argv[2], model_right = argv[3];
+  auto model_left = cmd[2], model_right = cmd[3];
 
-  if (argc == 5 && std::string(argv[4]) == "--show-board") {
+  if (cmd["--show-board"]) {
     DEBUG_SHOW_GAMEBOARD = true;
     THREAD_COUNT = 1;
   }
-  if (argc >= 5 && std::string(argv[4]) == "--output-best") {
+  // the file names are optional
+  if (cmd["--output-best"] || cmd("--output-best")) {
     OUTPUT_BEST = true;
-    if (argc >= 6) {
-      OUTPUT_BEST_FILE = argv[5];
-    }
+    cmd("--output-best", OUTPUT_BEST_FILE) >> OUTPUT_BEST_FILE;
   }
-  if (argc >= 5 && std::string(argv[4]) == "--output-data") {
-    OUTPUT_DATA = true;
-    if (argc >= 6) {
-      OUTPUT_DATA_FILE = argv[5];
-    }
-  } else if (argc >= 7 && std::string(argv[6]) == "--output-data") {
+  if (cmd["--output-data"] || cmd("--output-data")) {
     OUTPUT_DATA = true;
-    if (argc >= 8) {
-      OUTPUT_DATA_FILE = argv[7];
-    }
+    cmd("--output-data", OUTPUT_DATA_FILE) >> OUTPUT_DATA_FILE;
   }
 
+  // evaluate through the local inference server (serve_shadow) instead of loading the models.
+  USE_SERVER = cmd["--server"];
+
   if (torch::cuda::is_available() && torch::cuda::device_count() >= 2) {
     USE_TWO_GPU = true;
   }
 
   Algorithm zero;
-  QueuedLibtorchEvaluator* evaluator[2];
-  evaluator[0] = new QueuedLibtorchEvaluator(model_left, Shadow::CANONICAL_SHAPE,
-                                             /*use_cpu_only=*/false);
-  evaluator[1] = new QueuedLibtorchEvaluator(model_right, Shadow::CANONICAL_SHAPE,
-                                             /*use_cpu_only=*/false,
-                                             /*device_id=*/USE_TWO_GPU ? 1 : 0);
+  EvaluatorBase* evaluator[2];
+  // the two models take turns on each device instead of interleaving small batches.
+  DeviceScheduler schedulers[2];
+  if (USE_SERVER) {
+    evaluator[0] = new SharedMemoryEvaluator(model_left, Shadow::CANONICAL_SHAPE, Shadow::NUM_ACTIONS);
+    evaluator[1] = new SharedMemoryEvaluator(model_right, Shadow::CANONICAL_SHAPE, Shadow::NUM_ACTIONS);
+  } else if (USE_TWO_GPU) {
+    // both models on both devices, each request goes to the less loaded one.
+    for (int i = 0; i < 2; i++) {
+      const auto& model = i == 0 ? model_left : model_right;
+      std::vector<EvaluatorBase*> backends;
+      for (int device = 0; device < 2; device++) {
+        auto backend = new QueuedLibtorchEvaluator(model, Shadow::CANONICAL_SHAPE,
+                                                   /*use_cpu_only=*/false, /*device_id=*/device);
+        backend->share_device(schedulers[device]);
+        backends.push_back(backend);
+      }
+      evaluator[i] = new EvaluatorPool(backends);
+    }
+  } else {
+    for (int i = 0; i < 2; i++) {
+      auto queued = new QueuedLibtorchEvaluator(i == 0 ? model_left : model_right, Shadow::CANONICAL_SHAPE,
+                                                /*use_cpu_only=*/false);
+      queued->share_device(schedulers[0]);
+      evaluator[i] = queued;
+    }
+  }
 
   float win_count[2] = {0};
   float total_score[2][2] = {0};
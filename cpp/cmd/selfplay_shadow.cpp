@@ -1,8 +1,15 @@
 #include "core/algorithm/strategy_alphazero.h"
+#include "core/evaluator/cached.h"
+#include "core/evaluator/libtorch_quantized.h"
 #include "core/evaluator/libtorch_queued.h"
+#include "core/evaluator/native.h"
+#include "core/evaluator/pool.h"
+#include "core/evaluator/remote_client.h"
+#include "core/evaluator/replay.h"
 #include "game/shadow.h"
 
 #include "core/util/argh.h"
+#include "core/util/io.h"
 
 constexpr bool DEBUG_SHOW_ACTIONS_PER_TURN = false;
 constexpr bool DEBUG_SHOW_GAMEBOARD = false;
@@ -18,6 +25,16 @@ constexpr int WORKER_THREADS = 32;
 constexpr int GPU_EVALUATOR_COUNT = 1;
 constexpr int CPU_EVALUATOR_COUNT = 0;
 
+// evaluate mirrored positions once, and remember recent results.
+constexpr bool SYMMETRY_FOLDING = true;
+constexpr int EVALUATOR_CACHE_SIZE = 1 << 14;
+
+// batches are padded up to powers of two up to this size, each warmed up at startup.
+constexpr int MAX_BATCH_BUCKET = 256;
+
+// how often the daemon mode checks for a new model.
+constexpr auto DAEMON_POLL_INTERVAL = std::chrono::seconds(10);
+
 using Game = Shadow::GameState;
 using Algorithm = alphazero::Algorithm<Game, 0>;
 
@@ -43,38 +60,108 @@ int count_current_dataset(const char* output_dir) {
 }
 
 int main(int argc, const char** argv) {
-  argh::parser cmd({"-m", "--model", "-o", "--output-dir", "-c", "--count"});
+  argh::parser cmd({"-m", "--model", "-q", "--quantized-model", "-w", "--native-weights", "-r", "--remote", "-d", "--daemon", "-o", "--output-dir", "-c", "--count", "--record", "--prefetch"});
   cmd.parse(argc, argv);
   auto model = cmd({"-m", "--model"}).str();
+  // int8 model exported by python/quantize.py, used by the cpu evaluators when given.
+  auto quantized_model = cmd({"-q", "--quantized-model"}).str();
+  // weights exported by python/export_native.py, used by the cpu evaluators when given.
+  auto native_weights = cmd({"-w", "--native-weights"}).str();
+  // host:port of an inference server (serve_shadow --tcp) serving the model, used by all evaluators when given.
+  auto remote = cmd({"-r", "--remote"}).str();
+  // daemon mode: file holding the path of the model to play with. It is polled and a new
+  // model is swapped into the running evaluators. Games never stop, they are written in
+  // chunks of <count> games to <output_dir>/NNNN/, and a chunk gets a "done" file when full.
+  auto daemon_model_file = cmd({"-d", "--daemon"}).str();
+  bool daemon = !daemon_model_file.empty();
   auto output_dir = cmd({"-o", "--output-dir"}).str();
   int gen_dataset_count;
   cmd({"-c", "--count"}, 1024) >> gen_dataset_count;
+  // file recording every network evaluation, to replay the searches offline (benchmark_alphazero --replay).
+  auto record = cmd("--record").str();
+  // speculative evaluations a search may add to batches with spare slots, see alphazero::Algorithm.
+  int prefetch;
+  cmd("--prefetch", 0) >> prefetch;
   if (model.empty() || output_dir.empty()) {
     std::cout << "Usage: " << argv[0] << " <model> <output_dir>" << std::endl;
     return 1;
   }
+  if (daemon && (!remote.empty() || !quantized_model.empty() || !native_weights.empty())) {
+    std::cerr << "The daemon mode only swaps libtorch models of local evaluators." << std::endl;
+    return 1;
+  }
 
   auto rand = init_rand();
   c10::InferenceMode guard;
-  Algorithm algorithm;
-  QueuedLibtorchEvaluator* evaluators[GPU_EVALUATOR_COUNT + CPU_EVALUATOR_COUNT];
-  for (int i = 0; i < CPU_EVALUATOR_COUNT; i++) {
-    evaluators[i] = new QueuedLibtorchEvaluator(model, Shadow::CANONICAL_SHAPE,
-                                                /*cpu_only=*/true);
+  Algorithm algorithm(alphazero::CPUCT, alphazero::FPU_REDUCTION, SYMMETRY_FOLDING, prefetch);
+  std::unique_ptr<RemoteEvaluator> remote_evaluator;
+  QueuedEvaluator* evaluators[GPU_EVALUATOR_COUNT + CPU_EVALUATOR_COUNT] = {};
+  if (!remote.empty()) {
+    auto colon = remote.rfind(':');
+    remote_evaluator = std::make_unique<RemoteEvaluator>(
+        remote.substr(0, colon), std::stoi(remote.substr(colon + 1)), std::filesystem::path(model).filename().string(),
+        Shadow::CANONICAL_SHAPE, Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS);
   }
-  for (int i = CPU_EVALUATOR_COUNT; i < CPU_EVALUATOR_COUNT + GPU_EVALUATOR_COUNT; i++) {
-    evaluators[i] = new QueuedLibtorchEvaluator(model, Shadow::CANONICAL_SHAPE, /*cpu_only=*/false,
+  // evaluators load and warm up their models in the background, while the output directory is scanned.
+  std::vector<std::future<QueuedEvaluator*>> loading;
+  for (int i = 0; remote.empty() && i < CPU_EVALUATOR_COUNT + GPU_EVALUATOR_COUNT; i++) {
+    loading.push_back(std::async(std::launch::async, [&, i]() -> QueuedEvaluator* {
+      QueuedEvaluator* evaluator;
+      if (i >= CPU_EVALUATOR_COUNT) {
+        evaluator = new QueuedLibtorchEvaluator(model, Shadow::CANONICAL_SHAPE, /*cpu_only=*/false,
                                                 /*device_id=*/i - CPU_EVALUATOR_COUNT);
+      } else if (!native_weights.empty()) {
+        evaluator = new NativeEvaluator<native::ShadowNNArch>(native_weights);
+      } else if (!quantized_model.empty()) {
+        evaluator = new QuantizedLibtorchEvaluator(quantized_model, Shadow::CANONICAL_SHAPE);
+      } else {
+        evaluator = new QueuedLibtorchEvaluator(model, Shadow::CANONICAL_SHAPE,
+                                                /*cpu_only=*/true);
+      }
+      evaluator->set_batch_buckets(power_of_two_buckets(MAX_BATCH_BUCKET));
+      return evaluator;
+    }));
   }
 
   if (!std::filesystem::exists(output_dir)) {
     std::filesystem::create_directories(output_dir);
   }
-  std::atomic<int> dataset_id = count_current_dataset(output_dir.c_str());
+  int first_chunk = 0;
+  while (daemon && std::filesystem::exists(std::format("{}/{:04d}", output_dir, first_chunk))) {
+    first_chunk++;
+  }
+  std::atomic<int> dataset_id = daemon ? 0 : count_current_dataset(output_dir.c_str());
+
+  for (size_t i = 0; i < loading.size(); i++) evaluators[i] = loading[i].get();
+  // every worker goes through one pool, which sends each request to the least loaded evaluator.
+  std::unique_ptr<EvaluatorPool> pool;
+  EvaluatorBase* network_evaluator = remote_evaluator.get();
+  if (!remote_evaluator) {
+    pool = std::make_unique<EvaluatorPool>(std::vector<EvaluatorBase*>(std::begin(evaluators), std::end(evaluators)));
+    network_evaluator = pool.get();
+  }
+  std::unique_ptr<RecordingEvaluator> recording_evaluator;
+  if (!record.empty()) {
+    recording_evaluator = std::make_unique<RecordingEvaluator>(network_evaluator, record, Shadow::CANONICAL_SHAPE,
+                                                               Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS);
+    network_evaluator = recording_evaluator.get();
+  }
+  CachedEvaluator cached_evaluator(network_evaluator, Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS, EVALUATOR_CACHE_SIZE);
 
   std::atomic<bool> stop = false;
 
-  auto work = [&](int evaluator_id) {
+  // every saved position is tagged with the model that evaluated its search, in models.txt
+  // of its directory: one line per game, its index then the model of each position.
+  // Evaluators clear the cache as they switch models, each cache generation maps to
+  // the model of all evaluators, or to "" while some of them still run the old one.
+  // A search spanning a switch is run again.
+  std::mutex model_mutex, output_mutex;
+  std::condition_variable model_cv;
+  std::string current_model = model;
+  std::vector<std::string> generation_models = {model};
+  std::map<int, int> chunk_games;
+
+  auto work = [&]() {
     while (!stop) {
       Game game;
 
@@ -95,6 +182,7 @@ int main(int argc, const char** argv) {
       float temperature = TEMPERATURE_START;
       int turn;
       std::vector<std::unique_ptr<Algorithm::Context>> contexts;
+      std::vector<std::string> context_models;
       int valid_move_count;
 
       for (turn = 0; !stop && !game.End(); turn++) {
@@ -115,10 +203,23 @@ int main(int argc, const char** argv) {
 
         temperature = std::exp(TEMPERATURE_LAMBDA * turn) * (temperature - TEMPERATURE_END) + TEMPERATURE_END;
 
-        auto context = algorithm.compute(game, *evaluators[evaluator_id]);
-        context->step(capped ? PLAYOUT_CAP_NUM : PLAYOUT_NUM,
-                      /*root_noise_enabled=*/!capped,
-                      /*force_playout=*/!capped);
+        std::string context_model;
+        std::unique_ptr<Algorithm::Context> context;
+        // waits while the evaluators switch models, searches again when they switched meanwhile.
+        for (int generation = -1; generation != cached_evaluator.generation();) {
+          {
+            std::unique_lock<std::mutex> lock(model_mutex);
+            model_cv.wait(lock, [&]() {
+              generation = cached_evaluator.generation();
+              return !generation_models[generation].empty();
+            });
+            context_model = generation_models[generation];
+          }
+          context = algorithm.compute(game, cached_evaluator);
+          context->step(capped ? PLAYOUT_CAP_NUM : PLAYOUT_NUM,
+                        /*root_noise_enabled=*/!capped,
+                        /*force_playout=*/!capped);
+        }
         auto action = context->select_move(temperature);
 
         if (action < 0 || action >= Shadow::NUM_ACTIONS || !valid_moves[action]) {
@@ -131,6 +232,7 @@ int main(int argc, const char** argv) {
 
         if (!capped) {
           contexts.emplace_back(std::move(context));
+          context_models.push_back(std::filesystem::path(context_model).filename().string());
         }
 
         if constexpr (DEBUG_SHOW_GAMEBOARD) {
@@ -188,31 +290,86 @@ int main(int argc, const char** argv) {
       }
 
       int index = dataset_id.fetch_add(1);
-      if (index >= gen_dataset_count) {
+      if (!daemon && index >= gen_dataset_count) {
         stop = true;
       }
 
       std::cout << "Iteration " << index << ", score is " << score << std::endl;
 
-      auto c_path = std::format("{}/c_{:04d}_{}.pt", output_dir, index, n);
-      auto p_path = std::format("{}/p_{:04d}_{}.pt", output_dir, index, n);
-      auto v_path = std::format("{}/v_{:04d}_{}.pt", output_dir, index, n);
+      int chunk = first_chunk + index / gen_dataset_count;
+      auto dir = output_dir;
+      if (daemon) {
+        dir = std::format("{}/{:04d}", output_dir, chunk);
+        std::filesystem::create_directories(dir);
+        index %= gen_dataset_count;
+      }
+      auto c_path = std::format("{}/c_{:04d}_{}.pt", dir, index, n);
+      auto p_path = std::format("{}/p_{:04d}_{}.pt", dir, index, n);
+      auto v_path = std::format("{}/v_{:04d}_{}.pt", dir, index, n);
       torch::pickle_save(canonical, c_path);
       torch::pickle_save(policy, p_path);
       torch::pickle_save(values, v_path);
+
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::ofstream models(dir + "/models.txt", std::ios::app);
+      models << std::format("{:04d}", index);
+      for (const auto& context_model : context_models) {
+        models << " " << context_model;
+      }
+      models << std::endl;
+      if (daemon && ++chunk_games[chunk] == gen_dataset_count) {
+        writeStringToFile(dir + "/done", "");
+        chunk_games.erase(chunk);
+        std::cout << "Chunk " << dir << " done." << std::endl;
+      }
     }
   };  // work
 
   std::vector<std::thread> threads;
   for (int thread_id = 0; thread_id < WORKER_THREADS; thread_id++) {
-    threads.emplace_back(work, thread_id % (GPU_EVALUATOR_COUNT + CPU_EVALUATOR_COUNT));
+    threads.emplace_back(work);
+  }
+  if (daemon) {
+    threads.emplace_back([&]() {
+      while (!stop) {
+        std::this_thread::sleep_for(DAEMON_POLL_INTERVAL);
+        auto next_model = readStringFromFile(daemon_model_file);
+        if (next_model.empty() || next_model == current_model || !std::filesystem::exists(next_model)) {
+          continue;
+        }
+        std::cout << "Swapping in model " << next_model << std::endl;
+        // the evaluators load the model together, so that they switch at about the same time.
+        int switched = 0;
+        auto activated = [&]() {
+          std::lock_guard<std::mutex> lock(model_mutex);
+          cached_evaluator.clear();
+          bool all = ++switched == GPU_EVALUATOR_COUNT + CPU_EVALUATOR_COUNT;
+          generation_models.push_back(all ? next_model : "");
+          if (all) model_cv.notify_all();
+        };
+        std::vector<std::thread> swaps;
+        for (auto evaluator : evaluators) {
+          swaps.emplace_back([&, evaluator]() { evaluator->swap_model(next_model, activated); });
+        }
+        for (auto& swap : swaps) swap.join();
+        current_model = next_model;
+      }
+    });
   }
   threads.emplace_back([&]() {
-    while (!stop && dataset_id.load() < gen_dataset_count) {
+    while (!stop && (daemon || dataset_id.load() < gen_dataset_count)) {
       std::this_thread::sleep_for(std::chrono::seconds(10));
-      for (int i = 0; i < CPU_EVALUATOR_COUNT + GPU_EVALUATOR_COUNT; i++) {
-        std::cout << "Evaluator " << i << ": " << evaluators[i]->statistics() << std::endl;
+      // stats of the last interval only.
+      if (remote_evaluator) {
+        std::cout << "Remote: " << remote_evaluator->statistics() << std::endl;
+      } else {
+        for (int i = 0; i < CPU_EVALUATOR_COUNT + GPU_EVALUATOR_COUNT; i++) {
+          std::cout << "Evaluator " << i << ": " << evaluators[i]->statistics() << std::endl;
+        }
+        std::cout << "Pool: " << pool->statistics() << std::endl;
       }
+      std::cout << "Total: " << cached_evaluator.stats().to_string() << std::endl;
+      cached_evaluator.reset_stats();
     }
   });
   for (auto& thread : threads) {
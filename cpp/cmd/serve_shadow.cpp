@@ -0,0 +1,90 @@
+#include <csignal>
+
+#include "core/evaluator/libtorch_queued.h"
+#include "core/evaluator/native.h"
+#include "core/evaluator/remote_server.h"
+#include "core/evaluator/shm_server.h"
+#include "game/shadow.h"
+
+// Inference server: serves each model given on the command line to the
+// processes of this host started with --server (see core/evaluator/shm_client.h),
+// and with --tcp to remote clients by model file name (see core/evaluator/remote_client.h),
+// on loopback unless --bind gives the address to listen on ("::" for all interfaces).
+// Models are TorchScript files, or native weights (.bin) run on the cpu.
+// Runs until SIGINT or SIGTERM.
+
+constexpr int SLOT_COUNT = 1024;
+
+std::atomic<bool> stop = false;
+
+int main(int argc, const char** argv) {
+  bool cpu_only = false;
+  int tcp_port = 0;
+  std::string bind_address = "localhost";
+  std::vector<std::string> models;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--cpu") {
+      cpu_only = true;
+    } else if (std::string(argv[i]) == "--tcp" && i + 1 < argc) {
+      tcp_port = std::stoi(argv[++i]);
+    } else if (std::string(argv[i]) == "--bind" && i + 1 < argc) {
+      bind_address = argv[++i];
+    } else if (std::find(models.begin(), models.end(), argv[i]) == models.end()) {
+      models.push_back(argv[i]);
+    }
+  }
+  if (models.empty()) {
+    std::cout << "Usage: " << argv[0] << " [--cpu] [--tcp <port> [--bind <address>]] <model>..." << std::endl;
+    return 1;
+  }
+
+  std::signal(SIGINT, [](int) { stop = true; });
+  std::signal(SIGTERM, [](int) { stop = true; });
+
+  int device_count = cpu_only ? 1 : std::max<int>(1, torch::cuda::device_count());
+  // the models on a device take turns on it.
+  std::vector<DeviceScheduler> schedulers(device_count);
+  std::vector<std::unique_ptr<QueuedEvaluator>> evaluators;
+  std::vector<std::unique_ptr<SharedMemoryServer>> servers;
+  std::map<std::string, EvaluatorBase*> remote_evaluators;
+  for (int i = 0; i < (int)models.size(); i++) {
+    if (std::filesystem::path(models[i]).extension() == ".bin") {
+      evaluators.emplace_back(std::make_unique<NativeEvaluator<native::ShadowNNArch>>(models[i]));
+    } else {
+      evaluators.emplace_back(std::make_unique<QueuedLibtorchEvaluator>(models[i], Shadow::CANONICAL_SHAPE, cpu_only,
+                                                                        /*device_id=*/i % device_count));
+      evaluators[i]->share_device(schedulers[i % device_count]);
+    }
+    evaluators[i]->set_batch_buckets(power_of_two_buckets(SLOT_COUNT));
+    remote_evaluators[std::filesystem::path(models[i]).filename().string()] = evaluators[i].get();
+    servers.emplace_back(std::make_unique<SharedMemoryServer>(evaluators[i].get(), shm::channel_name(models[i]),
+                                                              Shadow::CANONICAL_SHAPE, Shadow::NUM_PLAYERS,
+                                                              Shadow::NUM_ACTIONS, SLOT_COUNT));
+  }
+
+  std::vector<std::thread> threads;
+  for (auto& server : servers) {
+    threads.emplace_back([&server]() { server->serve(stop); });
+  }
+  RemoteServer remote_server(remote_evaluators, Shadow::CANONICAL_SHAPE, Shadow::NUM_PLAYERS, Shadow::NUM_ACTIONS);
+  if (tcp_port) {
+    remote_server.listen(tcp_port, bind_address);
+    threads.emplace_back([&]() { remote_server.serve(stop); });
+  }
+  threads.emplace_back([&]() {
+    while (!stop) {
+      std::this_thread::sleep_for(std::chrono::seconds(10));
+      for (int i = 0; i < (int)models.size(); i++) {
+        std::cout << models[i] << ": " << servers[i]->statistics() << ", " << evaluators[i]->statistics()
+                  << std::endl;
+      }
+      if (tcp_port) {
+        std::cout << "Remote: " << remote_server.statistics() << std::endl;
+      }
+    }
+  });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return 0;
+}
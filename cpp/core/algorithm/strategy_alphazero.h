@@ -17,6 +17,9 @@ const float NOISE_ALPHA_RATIO = 10.83f;
 const float CPUCT = 3.0;
 const float FPU_REDUCTION = 0.25;
 
+// speculative evaluations kept per tree at most, see Algorithm::Context::prefetch.
+const int PREFETCH_CACHE_SIZE = 1024;
+
 struct ValueType {
   // v should be the winrate/score for player 0.
   // In this project, we only consider two-player zero sum games.
@@ -66,7 +69,7 @@ struct Node {
     std::shuffle(children.begin(), children.end(), rd);
   }
   size_t size() const noexcept { return children.size(); }
-  void update_policy(const std::vector<float>& pi) noexcept {
+  void update_policy(const float* pi) noexcept {
     for (auto& c : children) {
       c.policy = pi[c.move];
     }
@@ -143,38 +146,70 @@ class MCTS {
         }
       }
     }
+    legal_moves_.clear();
+    if (!current_->ended) {
+      for (auto& c : current_->children) {
+        legal_moves_.push_back(c.move);
+      }
+    }
     return leaf;
   }
 
-  void process_result(const float* pi, size_t size_pi, const float* v, bool root_noise_enabled = false) {
+  // likely next leaves: the highest-prior unvisited child of each node on the
+  // path to the last leaf, deepest first, where the next selections branch off.
+  // At most count positions, the last leaf and the positions skip() rejects are
+  // left out. Called between find_leaf and process_result.
+  template <typename Skip>
+  std::vector<std::unique_ptr<GameState>> speculative_leaves(const GameState& gs, int count, const Skip& skip) {
+    std::vector<std::unique_ptr<GameState>> states;
+    auto state = gs.Copy();
+    for (size_t k = 0; k < path_.size(); k++) {
+      states.push_back(state->Copy());
+      state->Move(k + 1 < path_.size() ? path_[k + 1]->move : current_->move);
+    }
+
+    std::vector<std::unique_ptr<GameState>> leaves;
+    for (int k = path_.size() - 1; k >= 0 && (int)leaves.size() < count; k--) {
+      const Node* best_prior = nullptr;
+      for (const auto& c : path_[k]->children) {
+        if (c.n == 0 && !c.ended && &c != current_ && (!best_prior || c.policy > best_prior->policy)) {
+          best_prior = &c;
+        }
+      }
+      if (best_prior) {
+        auto leaf = states[k]->Copy();
+        leaf->Move(best_prior->move);
+        if (!skip(*leaf)) {
+          leaves.push_back(std::move(leaf));
+        }
+      }
+    }
+    return leaves;
+  }
+
+  // legal moves of the last leaf, the evaluator normalizes its policy over them.
+  std::vector<int>& legal_moves() noexcept { return legal_moves_; }
+
+  // pi is expected to be normalized over the legal moves of the leaf.
+  void process_result(const float* pi, const float* v, bool root_noise_enabled = false) {
     ValueType value(current_->value);
 
     if (!current_->ended) {
       value = ValueType(v[current_->player], v[!current_->player]);
-      // Rescale pi based on valid moves.
-      std::vector<float> scaled(size_pi, 0);
-      float sum = 0;
-      for (auto& c : current_->children) {
-        sum += pi[c.move];
-      }
-      for (auto& c : current_->children) {
-        scaled[c.move] = pi[c.move] / sum;
-      }
       if (current_ == &root_) {
-        sum = 0;
+        float sum = 0;
         for (auto& c : current_->children) {
-          scaled[c.move] = std::pow(scaled[c.move], 1.0 / root_policy_temp_);
-          sum += scaled[c.move];
+          c.policy = std::pow(pi[c.move], 1.0 / root_policy_temp_);
+          sum += c.policy;
         }
         for (auto& c : current_->children) {
-          scaled[c.move] = scaled[c.move] / sum;
+          c.policy /= sum;
         }
-        current_->update_policy(scaled);
         if (root_noise_enabled) {
           add_root_noise();
         }
       } else {
-        current_->update_policy(scaled);
+        current_->update_policy(pi);
       }
     }
 
@@ -368,6 +403,7 @@ class MCTS {
 
  private:
   std::vector<Node*> path_{};
+  std::vector<int> legal_moves_{};
   float epsilon_;
   float root_policy_temp_;
   float fpu_reduction_;
@@ -376,13 +412,21 @@ class MCTS {
 template <class GameState, int SpecThreadCount>
 class Algorithm {
  public:
-  Algorithm(float cpuct_ = CPUCT, float fpu_reduction_ = FPU_REDUCTION)
-      : cpuct(cpuct_), fpu_reduction(fpu_reduction_) {}
+  // with symmetry_folding_, every leaf is evaluated as its canonical symmetry
+  // representative, so mirrored positions share one evaluation (and one cache entry).
+  // with prefetch_ > 0, searches send up to that many speculative evaluations along
+  // with a leaf when the evaluator has spare slots, see Context::prefetch.
+  Algorithm(float cpuct_ = CPUCT, float fpu_reduction_ = FPU_REDUCTION, bool symmetry_folding_ = false,
+            int prefetch_ = 0)
+      : cpuct(cpuct_), fpu_reduction(fpu_reduction_), symmetry_folding(symmetry_folding_), prefetch(prefetch_) {}
 
   struct Context {
-    Context(std::unique_ptr<GameState> game_, EvaluatorBase* evaluator_, float cpuct_, float fpu_reduction_)
+    Context(std::unique_ptr<GameState> game_, EvaluatorBase* evaluator_, float cpuct_, float fpu_reduction_,
+            bool symmetry_folding_ = false, int prefetch_ = 0)
         : game(std::move(game_)),
           evaluator(evaluator_),
+          symmetry_folding(symmetry_folding_),
+          prefetch(prefetch_),
           mcts(
               /*cpuct=*/cpuct_,
               /*num_moves=*/game->Num_actions(),
@@ -399,6 +443,79 @@ class Algorithm {
       }
     }
 
+    // result callback of the leaf of a tree.
+    struct TreeResult {
+      MCTS<GameState>* tree;
+      bool root_noise_enabled;
+
+      void operator()(const float* pi, const float* v) const { tree->process_result(pi, v, root_noise_enabled); }
+    };
+
+    // result of a speculative evaluation, see prefetched.
+    struct Prefetched {
+      std::vector<float> pi, v;
+    };
+
+    // result callback of a speculative leaf, keeps the result aside.
+    struct ParkResult {
+      Prefetched* result;
+      int num_actions;
+
+      void operator()(const float* pi, const float* v) const {
+        result->pi.assign(pi, pi + num_actions);
+        result->v.assign(v, v + 2);
+      }
+    };
+
+    // Evaluation request of a leaf, the callable is both its canonicalize
+    // (float*) and its process_result (pi, v), so requests are passed to the
+    // evaluator by reference without a copy of the leaf or an allocation. It
+    // refers to the leaf and the result callback, which outlive the evaluation.
+    // With symmetry folding the leaf is evaluated as the canonical symmetry
+    // representative, whose hash it is evaluated with.
+    struct LeafRequest {
+      const GameState* leaf;
+      ProcessResultFn process_result;
+      bool folded;
+
+      uint64_t hash() const { return folded ? leaf->Symmetry_hash(1) : leaf->Hash(); }
+
+      void operator()(float* storage) const {
+        if (!folded) {
+          leaf->Canonicalize(storage);
+          return;
+        }
+        thread_local std::vector<float> board;
+        board.assign(leaf->Canonical_size(), 0.0f);
+        leaf->Canonicalize(board.data());
+        leaf->create_symmetry_board(storage, board.data());
+      }
+
+      void operator()(const float* pi, const float* v) const {
+        if (!folded) {
+          process_result(pi, v);
+          return;
+        }
+        // symmetries are involutions, so mapping the policy again restores it.
+        thread_local std::vector<float> mirrored;
+        mirrored.resize(leaf->Num_actions());
+        leaf->create_symmetry_action(mirrored.data(), pi);
+        process_result(mirrored.data(), v);
+      }
+    };
+
+    // With symmetry folding, legal_moves are mapped in place to the actions of
+    // the representative.
+    LeafRequest leaf_request(const GameState& leaf, ProcessResultFn process_result, std::vector<int>& legal_moves) {
+      bool folded = symmetry_folding && leaf.Canonical_symmetry() != 0;
+      if (folded) {
+        for (auto& m : legal_moves) {
+          m = leaf.symmetry_action(m);
+        }
+      }
+      return {&leaf, process_result, folded};
+    }
+
     void step(int iterations, bool root_noise_enabled = false, bool force_playout = false) {
       if constexpr (SpecThreadCount == 0) {
         step_singlespec(iterations, root_noise_enabled, force_playout);
@@ -412,15 +529,77 @@ class Algorithm {
         auto leaf = mcts.find_leaf(*game, force_playout);
 
         if (mcts.current_->ended) {
-          mcts.process_result(nullptr, 0, nullptr, root_noise_enabled);
+          mcts.process_result(nullptr, nullptr, root_noise_enabled);
           continue;
         }
 
-        evaluator->evaluate(std::bind(&GameState::Canonicalize, *leaf, std::placeholders::_1),
-                            std::bind(&MCTS<GameState>::process_result, &mcts, std::placeholders::_1,
-                                      game->Num_actions(), std::placeholders::_2, root_noise_enabled),
-                            leaf->Hash());
+        if (prefetch > 0) {
+          auto it = prefetched.find(leaf->Hash());
+          if (it != prefetched.end()) {
+            mcts.process_result(it->second.pi.data(), it->second.v.data(), root_noise_enabled);
+            prefetched.erase(it);
+            prefetch_hits++;
+            continue;
+          }
+        }
+
+        TreeResult process_result{&mcts, root_noise_enabled};
+        auto request = leaf_request(*leaf, process_result, mcts.legal_moves());
+        int spare = prefetch > 0 ? std::min(prefetch, evaluator->spare_slots(1)) : 0;
+        if (spare > 0) {
+          evaluate_prefetching(spare, request);
+        } else {
+          evaluator->evaluate(request, request, request.hash(), mcts.legal_moves());
+        }
+      }
+    }
+
+    // Evaluates the leaf of request along with up to count speculative leaves,
+    // whose results are parked in prefetched until the search reaches them.
+    void evaluate_prefetching(int count, const LeafRequest& request) {
+      // positions speculated on but never reached are dropped all at once.
+      if (prefetched.size() >= PREFETCH_CACHE_SIZE) {
+        prefetched.clear();
+      }
+      std::vector<std::unique_ptr<GameState>> leaves;
+      std::vector<std::vector<int>> legal_moves{mcts.legal_moves()};
+      auto skip = [this](const GameState& leaf) { return leaf.End() || prefetched.contains(leaf.Hash()); };
+      for (auto& leaf : mcts.speculative_leaves(*game, count, skip)) {
+        std::vector<int> moves;
+        auto valid_moves = leaf->Valid_moves();
+        for (size_t m = 0; m < valid_moves.size(); m++) {
+          if (valid_moves[m]) {
+            moves.push_back(m);
+          }
+        }
+        if (!moves.empty()) {
+          leaves.push_back(std::move(leaf));
+          legal_moves.push_back(std::move(moves));
+        }
       }
+
+      int n = leaves.size() + 1;
+      // results are written to their own entry, callbacks may run on other threads.
+      std::vector<Prefetched> results(leaves.size());
+      std::vector<ParkResult> parks;
+      std::vector<LeafRequest> requests{request};
+      std::vector<uint64_t> hashvals{request.hash()};
+      parks.reserve(leaves.size());
+      for (int i = 1; i < n; i++) {
+        const auto& leaf = *leaves[i - 1];
+        parks.push_back({&results[i - 1], leaf.Num_actions()});
+        requests.push_back(leaf_request(leaf, parks.back(), legal_moves[i]));
+        hashvals.push_back(requests.back().hash());
+      }
+      std::vector<CanonicalizeFn> canonicalizes(requests.begin(), requests.end());
+      std::vector<ProcessResultFn> process_results(requests.begin(), requests.end());
+      std::vector<std::span<const int>> legal_spans(legal_moves.begin(), legal_moves.end());
+      evaluator->evaluateN(n, canonicalizes.data(), process_results.data(), hashvals.data(), legal_spans.data());
+
+      for (size_t i = 0; i < leaves.size(); i++) {
+        prefetched.try_emplace(leaves[i]->Hash(), std::move(results[i]));
+      }
+      prefetch_requests += leaves.size();
     }
 
     void step_multispec(int iterations, bool root_noise_enabled) {
@@ -428,8 +607,9 @@ class Algorithm {
       if constexpr (SpecThreadCount > 0) {
         if (!spec_initialized) {
           mcts.find_leaf(*game);
+          auto legal_moves = mcts.legal_moves();
           evaluator->evaluate(
-              std::bind(&GameState::Canonicalize, *game, std::placeholders::_1),
+              [this](float* storage) { game->Canonicalize(storage); },
               [this](const float* pi, const float* v) {
                 auto& children = mcts.root_children();
                 int count = children.size();
@@ -445,14 +625,14 @@ class Algorithm {
                                                        idx.begin() + count;
                                               }),
                                children.end());
-                mcts.process_result(pi, game->Num_actions(), v);
+                mcts.process_result(pi, v);
                 for (int i = 0; i < count; i++) {
                   specs[i]->root_children().emplace_back(idx[i]);
                   specs[i]->root_.player = game->Current_player();
-                  specs[i]->process_result(pi, game->Num_actions(), v);
+                  specs[i]->process_result(pi, v);
                 }
               },
-              game->Hash());
+              game->Hash(), legal_moves);
           spec_initialized = true;
         }
       }
@@ -478,6 +658,12 @@ class Algorithm {
             i));
       }
 
+      std::array<TreeResult, SpecThreadCount + 1> tree_results;
+      std::vector<LeafRequest> requests;
+      std::vector<CanonicalizeFn> canonicalizes;
+      std::vector<ProcessResultFn> process_results;
+      std::vector<uint64_t> hashvals;
+      std::vector<std::span<const int>> legal_moves;
       for (int iter = 0; iter < iterations; iter++) {
         for (int i = 0; i < specCount; i++) {
           ins[i].store(true);
@@ -488,17 +674,20 @@ class Algorithm {
           ins[i].wait(true);
         }
 
-        std::array<std::function<void(const float*, const float*)>, SpecThreadCount + 1> process_results;
-        std::array<std::function<void(float*)>, SpecThreadCount + 1> canonicalizes;
-        for (int i = 0; i < specCount; i++) {
-          canonicalizes[i] = std::bind(&GameState::Canonicalize, *leaves[i], std::placeholders::_1);
-          process_results[i] = std::bind(&MCTS<GameState>::process_result, specs[i].get(), std::placeholders::_1,
-                                         game->Num_actions(), std::placeholders::_2, false);
+        requests.clear();
+        hashvals.clear();
+        legal_moves.clear();
+        for (int i = 0; i <= specCount; i++) {
+          auto& tree = i < specCount ? *specs[i] : mcts;
+          tree_results[i] = {&tree, i < specCount ? false : root_noise_enabled};
+          requests.push_back(leaf_request(*leaves[i], tree_results[i], tree.legal_moves()));
+          hashvals.push_back(requests.back().hash());
+          legal_moves.push_back(tree.legal_moves());
         }
-        canonicalizes[specCount] = std::bind(&GameState::Canonicalize, *leaves[specCount], std::placeholders::_1);
-        process_results[specCount] = std::bind(&MCTS<GameState>::process_result, &mcts, std::placeholders::_1,
-                                               game->Num_actions(), std::placeholders::_2, root_noise_enabled);
-        evaluator->evaluateN(specCount + 1, canonicalizes.data(), process_results.data());
+        canonicalizes.assign(requests.begin(), requests.end());
+        process_results.assign(requests.begin(), requests.end());
+        evaluator->evaluateN(specCount + 1, canonicalizes.data(), process_results.data(), hashvals.data(),
+                             legal_moves.data());
       }
 
       for (auto& t : threads) {
@@ -620,19 +809,31 @@ class Algorithm {
 
     std::unique_ptr<GameState> game;
     EvaluatorBase* evaluator;
+    bool symmetry_folding;
+    int prefetch;  // speculative evaluations per leaf at most, 0 disables them
     MCTS<GameState> mcts;
     std::array<std::unique_ptr<MCTS<GameState>>, SpecThreadCount> specs;
     bool spec_initialized = false;
+
+    // Speculative prefetch (single tree searches only): when the evaluator reports
+    // spare slots for a leaf, the likely next leaves (MCTS::speculative_leaves)
+    // are evaluated in the same batch, and find_leaf results found here skip the
+    // evaluator. Entries are the policy over the legal moves and the value.
+    std::unordered_map<uint64_t, Prefetched> prefetched;
+    int64_t prefetch_requests = 0, prefetch_hits = 0;
   };
 
   std::unique_ptr<Context> compute(const GameState& game, EvaluatorBase& evaluator) {
-    auto context = std::make_unique<Context>(game.Copy(), &evaluator, cpuct, fpu_reduction);
+    auto context =
+        std::make_unique<Context>(game.Copy(), &evaluator, cpuct, fpu_reduction, symmetry_folding, prefetch);
     return context;
   }
 
  private:
   float cpuct;
   float fpu_reduction;
+  bool symmetry_folding;
+  int prefetch;
 };
 
 }  // namespace alphazero
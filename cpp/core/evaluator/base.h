@@ -1,12 +1,74 @@
 #pragma once
 
+#include "core/evaluator/stats.h"
 #include "core/util/common.h"
+#include "core/util/function_ref.h"
+#include "core/util/softmax.h"
+
+// callbacks of a request, any callable taking these arguments converts to them.
+// They are references: callables passed to evaluate()/evaluateN() must live
+// until the call returns, which temporaries in the call expression do.
+using CanonicalizeFn = FunctionRef<void(float*)>;
+using ProcessResultFn = FunctionRef<void(const float*, const float*)>;
+
+// requests submitted with EvaluatorBase::submit(). Owned by the caller, who may
+// submit it again once finished, its buffers are reused.
+struct Ticket {
+  std::vector<ProcessResultFn> process_results;
+  std::vector<uint64_t> rows;  // where the evaluator puts each result
+  bool finished = true;
+};
 
 // Evaluator interface
+// process_result receives the policy and value of the position. When the legal
+// moves of the position are given, only the policy entries of the legal moves
+// are filled, already normalized over the legal moves.
 class EvaluatorBase {
  public:
-  virtual void evaluate(std::function<void(float*)> canonicalize,
-                        std::function<void(const float*, const float*)> process_result, uint64_t hashval) = 0;
-  virtual void evaluateN(int N, std::function<void(float*)>* games,
-                         std::function<void(const float*, const float*)>* process_results) = 0;
-};
\ No newline at end of file
+  virtual void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval,
+                        std::span<const int> legal_moves) = 0;
+  virtual void evaluateN(int N, const CanonicalizeFn* games, const ProcessResultFn* process_results,
+                         const uint64_t* hashvals, const std::span<const int>* legal_moves) = 0;
+
+  // Non-blocking evaluateN(): queues the requests and returns, poll() or wait()
+  // finish the ticket, running its process_results in the calling thread. Until
+  // then the callables and legal moves must stay alive, canonicalize may run in
+  // another thread meanwhile. Every submitted ticket must be finished.
+  // Evaluators without a queue evaluate in submit(), the ticket is then already
+  // finished.
+  virtual void submit(Ticket& ticket, int N, const CanonicalizeFn* canonicalizes,
+                      const ProcessResultFn* process_results, const uint64_t* hashvals,
+                      const std::span<const int>* legal_moves) {
+    evaluateN(N, canonicalizes, process_results, hashvals, legal_moves);
+    ticket.finished = true;
+  }
+
+  // finishes the ticket if its results are ready, returns whether it is finished.
+  virtual bool poll(Ticket& ticket) { return ticket.finished; }
+
+  // blocks until the ticket is finished.
+  virtual void wait(Ticket& ticket) {}
+
+  // blocks until one of the tickets is finished, returns its index.
+  virtual int wait_any(std::span<Ticket* const> tickets) {
+    for (size_t i = 0; i < tickets.size(); i++) {
+      if (poll(*tickets[i])) return i;
+    }
+    wait(*tickets[0]);
+    return 0;
+  }
+
+  // counters since construction or the last reset_stats(), see core/evaluator/stats.h.
+  virtual EvaluatorStats stats() { return {}; }
+  virtual void reset_stats() {}
+
+  // requests that could ride along n requests submitted now at no extra cost, like
+  // rows the next batch would be padded with. Searches fill them with speculative
+  // evaluations.
+  virtual int spare_slots(int n) { return 0; }
+
+  // the same evaluator for latency-sensitive requests, like those of an analysis
+  // session sharing it with selfplay, which are batched ahead of the others.
+  // Evaluators without priority classes return themselves.
+  virtual EvaluatorBase* interactive() { return this; }
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+#include "core/util/lru_cache.h"
+
+// evaluator wrapper that remembers results by position hash.
+// requests without a hash (hashval == 0) are passed through unchanged.
+// Results are keyed by hash and by whether legal moves were given: the policy of
+// a request with legal moves is only valid on them (normalized over them, the
+// other entries are not filled), the one of a request without is the full
+// softmax. A position always has the same legal moves, so a cached masked policy
+// is valid for every later masked request of the same hash.
+// clear() starts a new generation of results: the results of requests sent
+// before it are passed on but not stored.
+class CachedEvaluator : public EvaluatorBase {
+ public:
+  CachedEvaluator(EvaluatorBase* evaluator_, int v_size_, int pi_size_, size_t capacity)
+      : evaluator(evaluator_), v_size(v_size_), pi_size(pi_size_), cache(capacity) {}
+
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    if (hashval == 0) {
+      evaluator->evaluate(canonicalize, process_result, hashval, legal_moves);
+      return;
+    }
+    Key key = {hashval, !legal_moves.empty()};
+    if (auto entry = lookup(key)) {
+      process_result(entry->data() + v_size, entry->data());
+      return;
+    }
+    Store store = {this, current_generation, hashval, legal_moves, process_result};
+    evaluator->evaluate(canonicalize, store, hashval, legal_moves);
+  }
+
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    if (hashvals == nullptr) {
+      evaluator->evaluateN(N, canonicalizes, process_results, hashvals, legal_moves);
+      return;
+    }
+
+    // only the missed positions are sent to the underlying evaluator.
+    int generation = current_generation;
+    std::vector<CanonicalizeFn> miss_canonicalizes;
+    std::vector<Store> miss_stores;
+    std::vector<uint64_t> miss_hashvals;
+    std::vector<std::span<const int>> miss_legal_moves;
+    for (int i = 0; i < N; i++) {
+      auto hashval = hashvals[i];
+      auto legal = legal_moves ? legal_moves[i] : std::span<const int>{};
+      if (hashval != 0) {
+        if (auto entry = lookup({hashval, !legal.empty()})) {
+          process_results[i](entry->data() + v_size, entry->data());
+          continue;
+        }
+      }
+      miss_canonicalizes.push_back(canonicalizes[i]);
+      miss_stores.push_back({this, generation, hashval, legal, process_results[i]});
+      miss_hashvals.push_back(hashval);
+      miss_legal_moves.push_back(legal);
+    }
+    if (!miss_hashvals.empty()) {
+      std::vector<ProcessResultFn> miss_process_results(miss_stores.begin(), miss_stores.end());
+      evaluator->evaluateN(miss_hashvals.size(), miss_canonicalizes.data(), miss_process_results.data(),
+                           miss_hashvals.data(), miss_legal_moves.data());
+    }
+  }
+
+  // forgets every result, e.g. when the underlying evaluator switches models (see
+  // QueuedEvaluator::swap_model()), and starts a new generation.
+  void clear() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache.clear();
+    current_generation++;
+  }
+
+  // number of clear() calls so far.
+  int generation() const { return current_generation; }
+
+  // stats of the underlying evaluator, with the hits and misses of the cache.
+  EvaluatorStats stats() {
+    auto stats = evaluator->stats();
+    stats.cache_hits = hits;
+    stats.cache_misses = misses;
+    return stats;
+  }
+
+  void reset_stats() {
+    evaluator->reset_stats();
+    hits = 0;
+    misses = 0;
+  }
+
+  int spare_slots(int n) { return evaluator->spare_slots(n); }
+
+  std::string statistics() {
+    std::stringstream ss;
+    int64_t total = hits + misses;
+    ss << "Cache hit rate: " << (total ? hits / (double)total : 0.0) << " (" << hits << "/" << total << ")";
+    return ss.str();
+  }
+
+ private:
+  // result callback of a missed position, stores the result before passing it on.
+  struct Store {
+    CachedEvaluator* cache;
+    int generation;  // of the cache when the request was sent
+    uint64_t hashval;
+    std::span<const int> legal_moves;
+    ProcessResultFn process_result;
+
+    void operator()(const float* pi, const float* v) const {
+      if (hashval != 0) cache->store(generation, hashval, legal_moves, pi, v);
+      process_result(pi, v);
+    }
+  };
+
+  // position hash, and whether the policy is masked to legal moves.
+  using Key = std::pair<uint64_t, bool>;
+  // cached entry is v followed by pi.
+  using Entry = std::shared_ptr<const std::vector<float>>;
+
+  Entry lookup(const Key& key) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (!cache.contains(key)) {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    return cache.must_get(key);
+  }
+
+  // a masked policy is stored with its legal entries only, the others are 0.
+  // Results of requests sent before the last clear() are dropped.
+  void store(int generation, uint64_t hashval, std::span<const int> legal_moves, const float* pi, const float* v) {
+    auto entry = std::make_shared<std::vector<float>>(v_size + pi_size);
+    std::copy(v, v + v_size, entry->begin());
+    if (legal_moves.empty()) {
+      std::copy(pi, pi + pi_size, entry->begin() + v_size);
+    } else {
+      for (int move : legal_moves) (*entry)[v_size + move] = pi[move];
+    }
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (generation != current_generation) return;
+    cache.insert({hashval, !legal_moves.empty()}, std::move(entry));
+  }
+
+  EvaluatorBase* evaluator;
+  int v_size, pi_size;
+
+  std::mutex cache_mutex;
+  lru_cache<Key, Entry> cache;
+  std::atomic<int64_t> hits = 0, misses = 0;
+  std::atomic<int> current_generation = 0;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "core/util/common.h"
+
+// Shares one device between the queued evaluators of several models, see
+// QueuedEvaluator::share_device(). Their evaluation threads take turns: one
+// batch is on the device at a time, so the kernels of different models do not
+// interleave, and the requests of a model keep accumulating into its next batch
+// while the others run.
+// The turn goes to the waiting model with the least device time divided by its
+// weight, so models get the device in proportion to their weights whatever their
+// batch sizes. A model back from idling starts from the current turn instead of
+// catching up on the time it did not use.
+class DeviceScheduler {
+ public:
+  // registers a model, returns its id.
+  int join(double weight = 1) {
+    std::lock_guard<std::mutex> lock(mutex);
+    clients.push_back({weight});
+    return clients.size() - 1;
+  }
+
+  // blocks until the device is free and it is the turn of model id.
+  void acquire(int id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto& client = clients[id];
+    client.virtual_time = std::max(client.virtual_time, current_time);
+    client.waiting = true;
+    cv.wait(lock, [&]() { return !busy && next() == id; });
+    client.waiting = false;
+    busy = true;
+    current_time = client.virtual_time;
+  }
+
+  // gives the device back after model id used it for ns.
+  void release(int id, int64_t ns) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto& client = clients[id];
+      client.virtual_time += ns / client.weight;
+      client.device_ns += ns;
+      client.turns++;
+      busy = false;
+    }
+    cv.notify_all();
+  }
+
+  // Per model: share of the device time and turns, since construction.
+  std::string statistics() {
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t total = 0;
+    for (const auto& client : clients) total += client.device_ns;
+    std::stringstream ss;
+    for (size_t i = 0; i < clients.size(); i++) {
+      ss << (i ? ", " : "") << "model " << i << ": device time " << clients[i].device_ns / std::max<double>(1, total)
+         << ", turns " << clients[i].turns;
+    }
+    return ss.str();
+  }
+
+ private:
+  struct Client {
+    double weight;
+    double virtual_time = 0;  // device time over weight
+    bool waiting = false;
+    int64_t device_ns = 0, turns = 0;
+  };
+
+  // the waiting model with the least virtual time.
+  int next() const {
+    int best = -1;
+    for (int i = 0; i < (int)clients.size(); i++) {
+      if (clients[i].waiting && (best < 0 || clients[i].virtual_time < clients[best].virtual_time)) best = i;
+    }
+    return best;
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Client> clients;  // stable references, evaluators hold their ids
+  bool busy = false;
+  double current_time = 0;  // virtual time of the last turn
+};
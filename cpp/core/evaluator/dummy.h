@@ -6,22 +6,27 @@
 class DummyEvaluator : public EvaluatorBase {
  public:
   DummyEvaluator(int v_size_, int pi_size_) : v_size(v_size_), pi_size(pi_size_) {}
-  void evaluate(std::function<void(float*)> canonicalize,
-                std::function<void(const float*, const float*)> process_result, uint64_t hashval = 0) {
-    auto v = std::make_unique<float[]>(v_size);
-    auto pi = std::make_unique<float[]>(pi_size);
-    for (int i = 0; i < v_size; i++) v[i] = 1.0 / v_size;
-    for (int i = 0; i < pi_size; i++) pi[i] = 1.0 / pi_size;
-    process_result(pi.get(), v.get());
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    thread_local std::vector<float> v, pi;
+    v.assign(v_size, 1.0 / v_size);
+    if (legal_moves.empty()) {
+      pi.assign(pi_size, 1.0 / pi_size);
+    } else {
+      pi.assign(pi_size, 0);
+      for (auto m : legal_moves) pi[m] = 1.0 / legal_moves.size();
+    }
+    process_result(pi.data(), v.data());
   }
-  void evaluateN(int N, std::function<void(float*)>* games,
-                 std::function<void(const float*, const float*)>* process_results) {
+  void evaluateN(int N, const CanonicalizeFn* games, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
     for (int i = 0; i < N; i++) {
-      evaluate(games[i], process_results[i]);
+      evaluate(games[i], process_results[i], hashvals ? hashvals[i] : 0,
+               legal_moves ? legal_moves[i] : std::span<const int>{});
     }
   }
 
  private:
   int v_size;
   int pi_size;
-};
\ No newline at end of file
+};
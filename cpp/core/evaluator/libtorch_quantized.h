@@ -0,0 +1,55 @@
+#pragma once
+
+#include "core/evaluator/queued.h"
+#include "core/util/libtorch.h"
+
+// queued cpu evaluator for the int8 models exported by python/quantize.py.
+// quantized kernels only run on the cpu, and the exported model is already
+// frozen, so it is not passed to optimize_for_inference (its mkldnn rewrites
+// do not accept quantized tensors).
+class QuantizedLibtorchEvaluator : public QueuedEvaluator {
+ public:
+  QuantizedLibtorchEvaluator(std::string model_path, const std::array<int, 3>& dimentions, bool warmup_ = true,
+                             bool verbose_ = true)
+      : QueuedEvaluator(dimentions), warmup(warmup_), verbose(verbose_) {
+    torch::print_libtorch_version();
+    torch::select_quantized_engine(verbose);
+
+    d1 = dimentions[0];
+    d2 = dimentions[1];
+    d3 = dimentions[2];
+
+    model = load(model_path);
+
+    start();
+  }
+
+  ~QuantizedLibtorchEvaluator() { stop(); }
+
+ protected:
+  void forward(int n, const float* input, std::vector<float>& v, std::vector<float>& pi) override {
+    c10::InferenceMode guard;
+    std::vector<torch::jit::IValue> inputs = {torch::from_blob(const_cast<float*>(input), {n, d1, d2, d3})};
+    auto outputs = model->forward(inputs).toTuple();
+    torch::copy_output(outputs->elements()[0].toTensor(), v);
+    torch::copy_output(outputs->elements()[1].toTensor(), pi);
+  }
+
+  void prepare_model(const std::string& model_path) override { next_model = load(model_path); }
+
+  void activate_model() override { model = std::move(next_model); }
+
+ private:
+  // evaluators of the same model share it, see torch::load_shared_model().
+  std::shared_ptr<torch::jit::script::Module> load(const std::string& model_path) {
+    c10::InferenceMode guard;
+    return torch::load_shared_model(model_path, torch::kCPU, verbose, /*optimize=*/false, [this](auto& module) {
+      if (warmup) torch::warm_up_model(module, {1, d1, d2, d3}, torch::TensorOptions(), verbose);
+    });
+  }
+
+  int d1, d2, d3;
+  bool warmup, verbose;
+
+  std::shared_ptr<torch::jit::script::Module> model, next_model;
+};
@@ -22,58 +22,39 @@ class LibtorchEvaluator : public EvaluatorBase {
     }
 #endif
     c10::InferenceMode guard;
-    try {
-      model = torch::jit::load(model_path, device);
-    } catch (const c10::Error& e) {
-      std::cerr << "Error loading the model: " << model_path << std::endl;
-      std::cerr << e.what() << std::endl;
-      exit(1);
-    }
-    if (model.is_training()) {
-      if (verbose) std::cout << "Warning: Model is in training mode. Calling eval()." << std::endl;
-      model.eval();
-    }
-
     d1 = dimentions[0];
     d2 = dimentions[1];
     d3 = dimentions[2];
 
-    // undocumented API that may be useful to optimize the model
-    torch::jit::optimize_for_inference(model);
-
-    // warm up the model
-    if (warmup) {
-      if (verbose) std::cout << "Warming up." << std::endl;
-      std::vector<torch::jit::IValue> inputs = {torch::ones({1, d1, d2, d3}, options)};
-      auto _ = model.forward(inputs).toTuple();
-      if (_->elements().size() > 0) {
-        if (verbose) std::cout << "Warm up ok." << std::endl;
-      }
-    }
+    // evaluators of the same model and device share it, see torch::load_shared_model().
+    model = torch::load_shared_model(model_path, device, verbose, /*optimize=*/true, [&](auto& module) {
+      if (warmup) torch::warm_up_model(module, {1, d1, d2, d3}, options, verbose);
+    });
   }
 
-  // TODO: maybe not pass std function as value here, e.g. use template.
-  //       maybe return std::future<void> here.
-  void evaluate(std::function<void(float*)> canonicalize,
-                std::function<void(const float*, const float*)> process_result, uint64_t hashval = 0) {
+  // runs in the calling thread, so does submit(). QueuedLibtorchEvaluator queues them.
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
     c10::InferenceMode guard;
     auto input = torch::zeros({1, d1, d2, d3});
     canonicalize(input.data_ptr<float>());
 
     std::vector<torch::jit::IValue> inputs = {input.to(device)};
     model_mutex.lock();
-    auto outputs = model.forward(inputs).toTuple();
+    auto outputs = model->forward(inputs).toTuple();
     model_mutex.unlock();
-    auto v = torch::exp(outputs->elements()[0].toTensor()).cpu();
-    auto pi = torch::exp(outputs->elements()[1].toTensor()).cpu();
+    auto v = outputs->elements()[0].toTensor().cpu().contiguous();
+    auto pi = outputs->elements()[1].toTensor().cpu().contiguous();
+    postprocess_output(v.data_ptr<float>(), v.numel(), pi.data_ptr<float>(), pi.numel(), legal_moves);
 
     process_result(pi.data_ptr<float>(), v.data_ptr<float>());
   }
 
-  void evaluateN(int N, std::function<void(float*)>* canonicalizes,
-                 std::function<void(const float*, const float*)>* process_results) {
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
     for (int i = 0; i < N; i++) {
-      evaluate(canonicalizes[i], process_results[i]);
+      evaluate(canonicalizes[i], process_results[i], hashvals ? hashvals[i] : 0,
+               legal_moves ? legal_moves[i] : std::span<const int>{});
     }
   }
 
@@ -84,6 +65,6 @@ class LibtorchEvaluator : public EvaluatorBase {
   int d1, d2, d3;
 
   std::mutex model_mutex;
-  torch::jit::script::Module model;
+  std::shared_ptr<torch::jit::script::Module> model;
   std::string model_path;
 };
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "core/evaluator/queued.h"
+#include "core/util/xxhash64.h"
+
+// queued evaluator without a model, simulating the latency of one, to measure
+// search and selfplay concurrency anywhere.
+// A batch takes batch_us plus item_us per position. Batches larger than
+// max_batch run as consecutive chunks of max_batch, like on a device that can
+// not hold more. Outputs are uniform, or with pseudo_policy a fixed pseudo-random
+// policy and value per position, seeded by the hash of its canonical input, so
+// searches see varied but reproducible priors.
+class MockEvaluator : public QueuedEvaluator {
+ public:
+  MockEvaluator(const std::array<int, 3>& dimentions, int v_size_, int pi_size_, int batch_us_ = 1000,
+                int item_us_ = 10, int max_batch_ = 256, bool pseudo_policy_ = false)
+      : QueuedEvaluator(dimentions),
+        input_size(dimentions[0] * dimentions[1] * dimentions[2]),
+        v_size(v_size_),
+        pi_size(pi_size_),
+        batch_us(batch_us_),
+        item_us(item_us_),
+        max_batch(max_batch_),
+        pseudo_policy(pseudo_policy_) {
+    start();
+  }
+
+  ~MockEvaluator() { stop(); }
+
+ protected:
+  void forward(int n, const float* input, std::vector<float>& v, std::vector<float>& pi) override {
+    // sleep_until keeps the simulated time independent of the time spent here.
+    auto deadline = std::chrono::steady_clock::now();
+    for (int begin = 0; begin < n; begin += max_batch) {
+      deadline += std::chrono::microseconds(batch_us + item_us * std::min(max_batch, n - begin));
+    }
+
+    v.resize(n * v_size);
+    pi.resize(n * pi_size);
+    for (int i = 0; i < n; i++) {
+      float* v_row = v.data() + i * v_size;
+      float* pi_row = pi.data() + i * pi_size;
+      if (pseudo_policy) {
+        std::mt19937 gen(XXHash64::hash(input + (size_t)i * input_size, input_size * sizeof(float), 0));
+        std::normal_distribution<float> logit(0.0f, 1.0f);
+        for (int j = 0; j < v_size; j++) v_row[j] = logit(gen);
+        for (int j = 0; j < pi_size; j++) pi_row[j] = logit(gen);
+      } else {
+        std::fill(v_row, v_row + v_size, 0.0f);
+        std::fill(pi_row, pi_row + pi_size, 0.0f);
+      }
+      // outputs are log-softmax, like the networks'.
+      log_softmax(v_row, v_size);
+      log_softmax(pi_row, pi_size);
+    }
+
+    std::this_thread::sleep_until(deadline);
+  }
+
+ private:
+  static void log_softmax(float* x, int n) {
+    float max = *std::max_element(x, x + n), sum = 0;
+    for (int i = 0; i < n; i++) sum += std::exp(x[i] - max);
+    float log_sum = max + std::log(sum);
+    for (int i = 0; i < n; i++) x[i] -= log_sum;
+  }
+
+  int input_size, v_size, pi_size;
+  int batch_us, item_us, max_batch;
+  bool pseudo_policy;
+};
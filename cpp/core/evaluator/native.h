@@ -0,0 +1,35 @@
+#pragma once
+
+#include "core/evaluator/queued.h"
+#include "core/util/native_nn.h"
+
+// queued cpu evaluator running the network without libtorch, see core/util/native_nn.h.
+// Network is one of the native::NNArch specializations, e.g. native::ShadowNNArch.
+template <class Network>
+class NativeEvaluator : public QueuedEvaluator {
+ public:
+  explicit NativeEvaluator(std::string weights_path, bool verify_ = true, bool verbose_ = true)
+      : QueuedEvaluator(Network::kShape), verify(verify_), verbose(verbose_) {
+    network.load(weights_path, verify, verbose);
+    start();
+  }
+
+  ~NativeEvaluator() { stop(); }
+
+ protected:
+  void forward(int n, const float* input, std::vector<float>& v, std::vector<float>& pi) override {
+    v.resize(n * Network::kVSize);
+    pi.resize(n * Network::kPiSize);
+    network.forward(n, input, v.data(), pi.data());
+  }
+
+  void prepare_model(const std::string& weights_path) override {
+    next_network.load(weights_path, verify, verbose);
+  }
+
+  void activate_model() override { network = std::move(next_network); }
+
+ private:
+  bool verify, verbose;
+  Network network, next_network;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "core/evaluator/queued.h"
+#include "core/util/onnx.h"
+
+// onnx evaluator with the same batching as QueuedLibtorchEvaluator.
+// batches are run through io binding, directly from the batch buffer into the
+// output slots.
+class QueuedOnnxEvaluator : public QueuedEvaluator {
+ public:
+  QueuedOnnxEvaluator(std::string model_path_, const std::array<int, 3>& input_size, int output_action_size,
+                      bool cpu_only = false, int device_id = 0, bool warmup = true, bool verbose = true,
+                      int intra_op_threads = 0, int inter_op_threads = 0)
+      : QueuedEvaluator(input_size),
+        model_path(model_path_),
+        pi_size(output_action_size),
+        env(ORT_LOGGING_LEVEL_WARNING, "onnx_evaluator"),
+        memory_info(Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault)) {
+    d[0] = 1;
+    d[1] = input_size[0];
+    d[2] = input_size[1];
+    d[3] = input_size[2];
+
+    session_options =
+        Ort::evaluator_session_options(cpu_only, device_id, intra_op_threads, inter_op_threads, verbose);
+    session = std::make_unique<Ort::Session>(env, model_path_.c_str(), session_options);
+    binding = std::make_unique<Ort::IoBinding>(*session);
+
+    // warm up the model
+    if (warmup) {
+      if (verbose) std::cout << "Warming up." << std::endl;
+
+      std::vector<float> input(d[1] * d[2] * d[3], 1.0f), v, pi;
+      forward(1, input.data(), v, pi);
+
+      if (verbose) std::cout << "Warm up ok." << std::endl;
+    }
+
+    start();
+  }
+
+  ~QueuedOnnxEvaluator() { stop(); }
+
+ protected:
+  void forward(int n, const float* input, std::vector<float>& v, std::vector<float>& pi) override {
+    v.resize(n * 2);
+    pi.resize(n * pi_size);
+    Ort::run_bound(*session, *binding, memory_info, const_cast<float*>(input), d, v.data(), 2, pi.data(), pi_size,
+                   n);
+  }
+
+  void prepare_model(const std::string& model_path_) override {
+    next_session = std::make_unique<Ort::Session>(env, model_path_.c_str(), session_options);
+    next_binding = std::make_unique<Ort::IoBinding>(*next_session);
+    next_model_path = model_path_;
+  }
+
+  void activate_model() override {
+    binding = std::move(next_binding);
+    session = std::move(next_session);
+    model_path = next_model_path;
+  }
+
+ private:
+  std::string model_path;
+  int64_t d[4], pi_size;
+
+  Ort::Env env;
+  Ort::MemoryInfo memory_info;
+  Ort::SessionOptions session_options;
+  std::unique_ptr<Ort::Session> session, next_session;
+  std::unique_ptr<Ort::IoBinding> binding, next_binding;
+  std::string next_model_path;
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+
+// evaluator spreading requests over several backends (devices, cpu instances, other runtimes).
+// Each request or batch goes to the backend expected to finish it first: its
+// items in flight plus the new ones, times its measured time per item (an
+// exponential moving average, so slower backends get proportionally less).
+// With work stealing, evaluateN batches are cut into chunks that every backend
+// takes from as soon as it has nothing in flight, so a large batch is never held
+// up by one saturated backend.
+class EvaluatorPool : public EvaluatorBase {
+ public:
+  explicit EvaluatorPool(std::vector<EvaluatorBase*> backends_, bool work_stealing_ = false, int steal_chunk_ = 16)
+      : backends(backends_.size()), work_stealing(work_stealing_), steal_chunk(steal_chunk_) {
+    for (size_t i = 0; i < backends.size(); i++) {
+      backends[i].evaluator = backends_[i];
+    }
+    reset_statistics();
+    if (work_stealing) {
+      for (size_t i = 0; i < backends.size(); i++) {
+        helpers.emplace_back([this, i]() { help(i); });
+      }
+    }
+  }
+
+  ~EvaluatorPool() {
+    {
+      std::lock_guard<std::mutex> lock(job_mutex);
+      stopping = true;
+    }
+    job_cv.notify_all();
+    for (auto& helper : helpers) helper.join();
+  }
+
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    int i = pick(1);
+    run(i, 1, [&](EvaluatorBase* evaluator) {
+      evaluator->evaluate(canonicalize, process_result, hashval, legal_moves);
+    });
+  }
+
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    if (!work_stealing || N <= steal_chunk) {
+      int i = pick(N);
+      run(i, N, [&](EvaluatorBase* evaluator) {
+        evaluator->evaluateN(N, canonicalizes, process_results, hashvals, legal_moves);
+      });
+      return;
+    }
+
+    Job job{N, canonicalizes, process_results, hashvals, legal_moves};
+    {
+      std::lock_guard<std::mutex> lock(job_mutex);
+      jobs.push_back(&job);
+    }
+    job_cv.notify_all();
+    // the caller works on its own batch too, helpers of idle backends join in.
+    while (work_on(job, pick(steal_chunk))) {
+    }
+    for (int remaining; (remaining = job.remaining) != 0;) job.remaining.wait(remaining);
+    std::unique_lock<std::mutex> lock(job_mutex);
+    jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+    helper_cv.wait(lock, [&]() { return job.helpers == 0; });
+  }
+
+  // Per backend: share of requests, utilization (fraction of the time with something
+  // in flight) and average items in flight, since the last reset.
+  std::string statistics() {
+    std::stringstream ss;
+    auto now = clock_ns();
+    double elapsed = std::max<int64_t>(1, now - stats_since);
+    for (size_t i = 0; i < backends.size(); i++) {
+      auto& backend = backends[i];
+      int64_t busy = backend.busy_ns;
+      if (backend.in_flight > 0) busy += now - backend.busy_since;
+      ss << (i ? ", " : "") << "backend " << i << ": items " << backend.items << ", utilization "
+         << std::min(1.0, busy / elapsed) << ", avg in flight " << backend.in_flight_ns / elapsed;
+    }
+    return ss.str();
+  }
+
+  // stats of all backends together.
+  EvaluatorStats stats() {
+    EvaluatorStats stats;
+    for (auto& backend : backends) stats.merge(backend.evaluator->stats());
+    return stats;
+  }
+
+  void reset_stats() {
+    for (auto& backend : backends) backend.evaluator->reset_stats();
+    reset_statistics();
+  }
+
+  // spare slots of the backend the requests would go to.
+  int spare_slots(int n) { return backends[pick(n)].evaluator->spare_slots(n); }
+
+  void reset_statistics() {
+    stats_since = clock_ns();
+    for (auto& backend : backends) {
+      backend.items = 0;
+      backend.busy_ns = 0;
+      backend.in_flight_ns = 0;
+    }
+  }
+
+ private:
+  struct Backend {
+    EvaluatorBase* evaluator;
+    std::atomic<int> in_flight = 0;
+    std::atomic<double> item_ns = 0;  // moving average of the time per item
+    std::atomic<int64_t> items = 0, busy_ns = 0, busy_since = 0, in_flight_ns = 0;
+  };
+
+  struct Job {
+    int N;
+    const CanonicalizeFn* canonicalizes;
+    const ProcessResultFn* process_results;
+    const uint64_t* hashvals;
+    const std::span<const int>* legal_moves;
+    std::atomic<int> next = 0, remaining = N;
+    int helpers = 0;  // helpers working on the job, guarded by job_mutex
+  };
+
+  static int64_t clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // backend expected to finish n more items first.
+  int pick(int n) {
+    int best = 0;
+    double best_cost = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < backends.size(); i++) {
+      double cost = (backends[i].in_flight + n) * backends[i].item_ns;
+      if (cost < best_cost) {
+        best = i;
+        best_cost = cost;
+      }
+    }
+    return best;
+  }
+
+  template <class Fn>
+  void run(int i, int n, Fn fn) {
+    auto& backend = backends[i];
+    auto start = clock_ns();
+    if (backend.in_flight.fetch_add(n) == 0) backend.busy_since = start;
+    fn(backend.evaluator);
+    auto end = clock_ns();
+    backend.in_flight_ns += (end - start) * n;
+    if (backend.in_flight.fetch_sub(n) == n) {
+      backend.busy_ns += end - backend.busy_since;
+      // the helper of the backend may now steal, it checks in_flight under job_mutex.
+      if (work_stealing) {
+        { std::lock_guard<std::mutex> lock(job_mutex); }
+        job_cv.notify_all();
+      }
+    }
+    backend.items += n;
+    double item_ns = (end - start) / (double)n;
+    double average = backend.item_ns;
+    backend.item_ns = average == 0 ? item_ns : average * 0.9 + item_ns * 0.1;
+  }
+
+  // runs the next chunk of the job on backend i, false when no chunk is left.
+  bool work_on(Job& job, int i) {
+    int begin = job.next.fetch_add(steal_chunk);
+    if (begin >= job.N) return false;
+    int n = std::min(steal_chunk, job.N - begin);
+    run(i, n, [&](EvaluatorBase* evaluator) {
+      evaluator->evaluateN(n, job.canonicalizes + begin, job.process_results + begin,
+                           job.hashvals ? job.hashvals + begin : nullptr,
+                           job.legal_moves ? job.legal_moves + begin : nullptr);
+    });
+    if (job.remaining.fetch_sub(n) == n) job.remaining.notify_all();
+    return true;
+  }
+
+  // helper of backend i, steals chunks of pending jobs whenever the backend is idle.
+  // It sleeps until a job is queued or a backend becomes idle.
+  void help(int i) {
+    std::unique_lock<std::mutex> lock(job_mutex);
+    while (!stopping) {
+      Job* job = nullptr;
+      if (backends[i].in_flight == 0) {
+        for (auto candidate : jobs) {
+          if (candidate->next < candidate->N) {
+            job = candidate;
+            break;
+          }
+        }
+      }
+      if (!job) {
+        job_cv.wait(lock);
+        continue;
+      }
+      // the owner keeps the job alive until its helpers are done.
+      job->helpers++;
+      lock.unlock();
+      work_on(*job, i);
+      lock.lock();
+      job->helpers--;
+      helper_cv.notify_all();
+    }
+  }
+
+  std::vector<Backend> backends;
+  bool work_stealing;
+  int steal_chunk;
+  std::atomic<int64_t> stats_since = 0;
+
+  std::mutex job_mutex;
+  std::condition_variable job_cv, helper_cv;
+  std::vector<Job*> jobs;
+  std::vector<std::thread> helpers;
+  bool stopping = false;
+};
@@ -0,0 +1,574 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+#include "core/evaluator/device_scheduler.h"
+
+// batch buckets 1, 2, 4, ... up to max_size, see QueuedEvaluator::set_batch_buckets().
+inline std::vector<int> power_of_two_buckets(int max_size) {
+  std::vector<int> sizes;
+  for (int size = 1; size <= max_size; size *= 2) sizes.push_back(size);
+  return sizes;
+}
+
+// evaluator running the model in a separate thread, on batches of the pending requests.
+// Callbacks must stay valid until their results arrive: until evaluate() returns, or
+// the ticket of submit() is picked up. A ticket must be picked up within 64 batches of
+// its lane, its output slot is not reused before and the evaluation thread stalls.
+class QueuedEvaluator : public EvaluatorBase {
+ public:
+  explicit QueuedEvaluator(const std::array<int, 3>& dimentions) : interactive_lane(this) {
+    dx = dimentions[0] * dimentions[1] * dimentions[2];
+    for (auto& lane : lanes) {
+      for (auto& done : lane.job_done) done = false;
+      for (auto& unread : lane.unread) unread = 0;
+    }
+    reset_stats();
+  }
+
+  virtual ~QueuedEvaluator() { stop(); }
+
+  // Policies come normalized over the legal moves when given. A request with a hash
+  // rides along an identical one pending or in forward() (complementary to
+  // CachedEvaluator, which only knows finished results).
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    evaluate_blocking(kBulk, 1, &canonicalize, &process_result, &hashval, &legal_moves);
+  }
+
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    evaluate_blocking(kBulk, N, canonicalizes, process_results, hashvals, legal_moves);
+  }
+
+  // queues like evaluateN() without waiting, poll(), wait() and wait_any() pick up the results.
+  void submit(Ticket& ticket, int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+              const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    enqueue_all(kBulk, ticket, N, canonicalizes, process_results, hashvals, legal_moves);
+  }
+
+  bool poll(Ticket& ticket) {
+    if (ticket.finished) return true;
+    for (auto packed : ticket.rows) {
+      auto row = unpack(packed);
+      if (!lanes[row.lane].job_done[row.slot]) return false;
+    }
+    collect(ticket);
+    return true;
+  }
+
+  void wait(Ticket& ticket) {
+    if (!ticket.finished) collect(ticket);
+  }
+
+  // sleeps until the next batch finishes between two rounds of polls.
+  int wait_any(std::span<Ticket* const> tickets) {
+    while (true) {
+      int64_t seen = batches_done;
+      for (size_t i = 0; i < tickets.size(); i++) {
+        if (poll(*tickets[i])) return i;
+      }
+      batches_done.wait(seen);
+    }
+  }
+
+  // Lane of interactive requests. They run as a batch of their own as soon as the
+  // evaluation thread is free, ahead of the pending bulk batch, but never twice in a
+  // row while bulk requests wait.
+  EvaluatorBase* interactive() { return &interactive_lane; }
+
+  // Loads model_path and switches to it between two batches: batches already
+  // taken finish on the old model, all later ones run on the new one. The model
+  // is loaded (and warmed up) by the calling thread while batches keep running,
+  // only the batch buckets are warmed up again after the switch.
+  void swap_model(const std::string& model_path) {
+    swap_model(model_path, []() {});
+  }
+
+  // swap_model() calling activated in the evaluation thread right after the
+  // switch, before any batch runs on the new model: whatever it publishes (e.g.
+  // dropping cached results) is in place for every result of the new model.
+  void swap_model(const std::string& model_path, FunctionRef<void()> activated) {
+    std::lock_guard<std::mutex> lock(swap_mutex);
+    prepare_model(model_path);
+    between_batches([this, activated]() {
+      activate_model();
+      generation++;
+      activated();
+      warmup_buckets();
+    });
+  }
+
+  // Pads each batch up to the smallest of these sizes that holds it (larger batches
+  // run as they are), and runs the model once at each size, so the runtime plans
+  // each shape once instead of mid-run. Takes effect between two batches; the
+  // warmup pauses the evaluation thread meanwhile.
+  void set_batch_buckets(std::vector<int> sizes) {
+    std::sort(sizes.begin(), sizes.end());
+    between_batches([this, sizes = std::move(sizes)]() {
+      {
+        std::lock_guard<std::mutex> lock(input_mutex);
+        buckets = sizes;
+      }
+      warmup_buckets();
+    });
+  }
+
+  // Runs each batch in a turn of scheduler, shared with the evaluators of other
+  // models on the same device, weight is the share of the device time of this one.
+  // Takes effect between two batches.
+  void share_device(DeviceScheduler& scheduler, double weight = 1) {
+    int id = scheduler.join(weight);
+    between_batches([this, &scheduler, id]() {
+      device_scheduler = &scheduler;
+      scheduler_id = id;
+    });
+  }
+
+  // batches up to this size take about as long as a single row on the device
+  // (latency bound), spare_slots() offers the rows up to it.
+  void set_free_batch_size(int size) { free_batch_size = size; }
+
+  // padding rows of the next batch, and its rows below set_free_batch_size().
+  int spare_slots(int n) { return spare_slots(kBulk, n); }
+
+  // number of models swapped in since construction.
+  int model_generation() const { return generation; }
+
+  // batch sizes, time requests wait for their batch, forward time, idle time of the
+  // evaluation thread and latency of each lane.
+  EvaluatorStats stats() {
+    EvaluatorStats stats;
+    int64_t elapsed = std::max<int64_t>(1, clock_ns() - stats_since);
+    stats.seconds = elapsed / 1e9;
+    stats.requests = total_working_input_size + coalesced;
+    stats.coalesced = coalesced;
+    stats.batch_size = batch_size_histogram.snapshot();
+    stats.queue_wait_us = queue_wait_histogram.snapshot();
+    stats.forward_us = forward_histogram.snapshot();
+    stats.idle_fraction = std::max(0.0, 1 - busy_ns / (double)elapsed);
+    for (int i = 0; i < kPriorityCount; i++) stats.latency_us[i] = lanes[i].latency_histogram.snapshot();
+    return stats;
+  }
+
+  void reset_stats() {
+    batch_size_histogram.reset();
+    queue_wait_histogram.reset();
+    forward_histogram.reset();
+    for (auto& lane : lanes) lane.latency_histogram.reset();
+    total_working_input_size = 0;
+    total_padded_size = 0;
+    coalesced = 0;
+    busy_ns = 0;
+    stats_since = clock_ns();
+  }
+
+  std::string statistics() {
+    std::stringstream ss;
+    ss << stats().to_string();
+    if (total_padded_size != total_working_input_size) {
+      ss << ", padding: " << 1 - total_working_input_size / (double)total_padded_size;
+    }
+    return ss.str();
+  }
+
+ protected:
+  // Runs the model on a batch of n canonical inputs. v and pi receive the raw
+  // (log-softmax) outputs, n rows each, resized by the implementation.
+  virtual void forward(int n, const float* input, std::vector<float>& v, std::vector<float>& pi) = 0;
+
+  // Like forward(), but pi receives only the policy entries (rows[i], actions[i]),
+  // in that order. Returns the policy size of a row. Backends running on a device
+  // override it to gather there and copy only those entries back, by default the
+  // whole output is gathered on the host.
+  virtual int forward_gathered(int n, const float* input, const std::vector<int64_t>& rows,
+                               const std::vector<int64_t>& actions, std::vector<float>& v, std::vector<float>& pi) {
+    forward(n, input, v, full_pi);
+    int pi_size = full_pi.size() / n;
+    pi.resize(rows.size());
+    for (size_t i = 0; i < rows.size(); i++) {
+      pi[i] = full_pi[rows[i] * pi_size + actions[i]];
+    }
+    return pi_size;
+  }
+
+  // Loads the next model aside, in the thread calling swap_model().
+  virtual void prepare_model(const std::string& model_path) {
+    std::cerr << "This evaluator does not support swapping models: " << model_path << std::endl;
+    exit(1);
+  }
+
+  // Makes the prepared model the one used by forward(), in the evaluation thread between batches.
+  virtual void activate_model() {}
+
+  // Starts the evaluation thread, called by implementations once the model is ready.
+  void start() {
+    stop_eval = false;
+    eval_thread = std::make_unique<std::thread>([this]() {
+      int last_lane = kBulk;
+      while (!stop_eval) {
+        if (task_pending) {
+          task();
+          task_pending = false;
+          task_pending.notify_all();
+        }
+        if (lanes[kInteractive].size == 0 && lanes[kBulk].size == 0) {
+          // sleeps until wake_up() by a request, a task or stop().
+          int seen = wakeups;
+          if (lanes[kInteractive].size == 0 && lanes[kBulk].size == 0 && !task_pending && !stop_eval) {
+            wakeups.wait(seen);
+          }
+          continue;
+        }
+        int l = lanes[kInteractive].size > 0 && (last_lane == kBulk || lanes[kBulk].size == 0) ? kInteractive : kBulk;
+        auto& lane = lanes[l];
+        last_lane = l;
+        // the next pending batch gets the slot of the batch 64 batches ago, whose results must be picked up.
+        auto& unread = lane.unread[(lane.index + 2) % 64];
+        for (int n; (n = unread) != 0;) unread.wait(n);
+        // the batch is taken once the device is ours, it grows while other models run.
+        if (device_scheduler) device_scheduler->acquire(scheduler_id);
+        input_mutex.lock();
+        // swap buffers so that callers can fill the next batch during forward().
+        std::swap(lane.canonicalizes, batch_canonicalizes);
+        std::swap(lane.legal, batch_legal);
+        std::swap(lane.arrivals, batch_arrivals);
+        std::swap(lane.hashes, batch_hashes);
+        int batch_size = lane.size;
+        lane.canonicalizes.clear();
+        lane.legal.clear();
+        lane.arrivals.clear();
+        lane.hashes.clear();
+        lane.size = 0;
+        lane.index += 1;
+        uint8_t slot = lane.index % 64;
+        lane.job_done[(lane.index + 1) % 64] = false;
+        input_mutex.unlock();
+
+        // padding rows are zeros, their outputs are dropped.
+        auto start = clock_ns();
+        int padded_size = bucket_size(batch_size);
+        batch_input.assign(padded_size * dx, 0);
+        for (int i = 0; i < batch_size; i++) batch_canonicalizes[i](batch_input.data() + i * dx);
+
+        for (auto [arrival, count] : batch_arrivals) queue_wait_histogram.add((start - arrival) / 1000, count);
+        batch_size_histogram.add(batch_size);
+        total_working_input_size += batch_size;
+        total_padded_size += padded_size;
+
+        auto& output = lane.outputs[slot];
+        auto& offsets = output.pi_offsets;
+        offsets.resize(batch_size + 1);
+        output.compact = std::all_of(batch_legal.begin(), batch_legal.end(),
+                                     [](std::span<const int> legal) { return !legal.empty(); });
+        if (output.compact) {
+          // the legal moves are copied, coalesced callers read them after the first caller finished.
+          gather_rows.clear();
+          gather_actions.clear();
+          auto& moves = output.moves;
+          moves.clear();
+          for (int i = 0; i < batch_size; i++) {
+            offsets[i] = moves.size();
+            moves.insert(moves.end(), batch_legal[i].begin(), batch_legal[i].end());
+            gather_rows.insert(gather_rows.end(), batch_legal[i].size(), i);
+          }
+          offsets[batch_size] = moves.size();
+          gather_actions.assign(moves.begin(), moves.end());
+          output.pi_size =
+              forward_gathered(padded_size, batch_input.data(), gather_rows, gather_actions, output.v, output.pi);
+        } else {
+          forward(padded_size, batch_input.data(), output.v, output.pi);
+          output.pi_size = output.pi.size() / padded_size;
+          output.pi.resize(output.pi_size * batch_size);
+          for (int i = 0; i <= batch_size; i++) offsets[i] = i * output.pi_size;
+        }
+        output.v.resize(output.v.size() / padded_size * batch_size);
+        output.size = batch_size;
+        postprocess(output);
+
+        auto end = clock_ns();
+        if (device_scheduler) device_scheduler->release(scheduler_id, end - start);
+        forward_histogram.add((end - start) / 1000);
+        busy_ns += end - start;
+        for (auto [arrival, count] : batch_arrivals) lane.latency_histogram.add((end - arrival) / 1000, count);
+
+        lane.job_done[slot] = true;
+        lane.job_done[slot].notify_all();
+        batches_done++;
+        batches_done.notify_all();
+
+        // later requests of these positions are new evaluations again.
+        input_mutex.lock();
+        for (auto hashval : batch_hashes) pending_rows.erase(hashval);
+        input_mutex.unlock();
+      }
+    });
+  }
+
+  // Stops the evaluation thread. Implementations call it in their destructor,
+  // before the model used by forward() is destroyed.
+  void stop() {
+    stop_eval = true;
+    wake_up();
+    if (eval_thread && eval_thread->joinable()) {
+      eval_thread->join();
+    }
+  }
+
+ private:
+  // output slot of a batch. Row i of the policy is at pi_offsets[i], compact slots
+  // hold the entries of the legal moves moves[pi_offsets[i]...] only.
+  struct Output {
+    std::vector<float> pi, v;
+    int size = 0;
+    bool compact = false;
+    int pi_size = 0;
+    std::vector<int> pi_offsets, moves;
+  };
+
+  // pending batch and output ring of one priority class.
+  struct Lane {
+    std::vector<CanonicalizeFn> canonicalizes;  // callables owned by their waiting callers
+    std::vector<std::span<const int>> legal;
+    std::vector<std::pair<int64_t, int>> arrivals;  // enqueue time and count of each call
+    std::vector<uint64_t> hashes;
+    std::atomic<int> size = 0;
+    std::atomic<int> index = 0;  // batches taken
+    std::atomic<bool> job_done[64];
+    std::atomic<int> unread[64];  // results of the slot not yet picked up
+    Output outputs[64];
+    Histogram latency_histogram;  // from enqueue to results
+  };
+
+  // where the result of a request is, packed into Ticket::rows.
+  struct Row {
+    int lane;
+    uint8_t slot;
+    int row;
+  };
+
+  static uint64_t pack(Row row) { return (uint64_t)row.row << 16 | row.slot << 8 | row.lane; }
+
+  static Row unpack(uint64_t packed) { return {(int)(packed & 0xff), (uint8_t)(packed >> 8), (int)(packed >> 16)}; }
+
+  // submits to the interactive lane of its evaluator.
+  class InteractiveLane : public EvaluatorBase {
+   public:
+    explicit InteractiveLane(QueuedEvaluator* evaluator_) : evaluator(evaluator_) {}
+
+    void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                  std::span<const int> legal_moves = {}) {
+      evaluator->evaluate_blocking(kInteractive, 1, &canonicalize, &process_result, &hashval, &legal_moves);
+    }
+
+    void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                   const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+      evaluator->evaluate_blocking(kInteractive, N, canonicalizes, process_results, hashvals, legal_moves);
+    }
+
+    // queues like evaluateN() without waiting, poll(), wait() and wait_any() pick up the results.
+  void submit(Ticket& ticket, int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+      evaluator->enqueue_all(kInteractive, ticket, N, canonicalizes, process_results, hashvals, legal_moves);
+    }
+
+    bool poll(Ticket& ticket) { return evaluator->poll(ticket); }
+
+    void wait(Ticket& ticket) { evaluator->wait(ticket); }
+
+    int wait_any(std::span<Ticket* const> tickets) { return evaluator->wait_any(tickets); }
+
+    EvaluatorStats stats() { return evaluator->stats(); }
+
+    int spare_slots(int n) { return evaluator->spare_slots(kInteractive, n); }
+
+    EvaluatorBase* interactive() { return this; }
+
+   private:
+    QueuedEvaluator* evaluator;
+  };
+
+  void evaluate_blocking(int l, int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                         const uint64_t* hashvals, const std::span<const int>* legal_moves) {
+    thread_local Ticket ticket;
+    enqueue_all(l, ticket, N, canonicalizes, process_results, hashvals, legal_moves);
+    collect(ticket);
+  }
+
+  // Queues the requests in lane l, the ticket holds where their results will be.
+  void enqueue_all(int l, Ticket& ticket, int N, const CanonicalizeFn* canonicalizes,
+                   const ProcessResultFn* process_results, const uint64_t* hashvals,
+                   const std::span<const int>* legal_moves) {
+    assert(ticket.finished);
+    auto& lane = lanes[l];
+    ticket.process_results.assign(process_results, process_results + N);
+    ticket.rows.resize(N);
+    ticket.finished = false;
+    input_mutex.lock();
+    int current_size = lane.size;
+    for (int i = 0; i < N; i++) {
+      ticket.rows[i] = pack(enqueue(l, canonicalizes[i], hashvals ? hashvals[i] : 0,
+                                    legal_moves ? legal_moves[i] : std::span<const int>{}));
+    }
+    bool added = lane.size > current_size;
+    if (added) {
+      lane.arrivals.emplace_back(clock_ns(), lane.size - current_size);
+    }
+    input_mutex.unlock();
+    if (added) wake_up();
+  }
+
+  // Waits for the results of the ticket and hands them to its process_results.
+  void collect(Ticket& ticket) {
+    for (size_t i = 0; i < ticket.rows.size(); i++) {
+      auto [l, slot, row] = unpack(ticket.rows[i]);
+      auto& lane = lanes[l];
+      lane.job_done[slot].wait(false);
+      const auto& output = lane.outputs[slot];
+      assert(output.size > row);
+      ticket.process_results[i](output_pi_row(output, row), output_v_row(output, row));
+      if (--lane.unread[slot] == 0) lane.unread[slot].notify_all();
+    }
+    ticket.finished = true;
+  }
+
+  int spare_slots(int l, int n) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    int size = lanes[l].size + n;
+    return std::max(bucket_size(size), free_batch_size.load()) - size;
+  }
+
+  // Runs fn in the evaluation thread between two batches, or right away before it
+  // is started, and waits for it.
+  void between_batches(std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(task_mutex);
+    if (stop_eval) {
+      fn();
+      return;
+    }
+    task = std::move(fn);
+    task_pending = true;
+    wake_up();
+    task_pending.wait(true);
+  }
+
+  // Adds a request to the pending batch of lane l, or finds the row of an
+  // identical one pending or in flight. Returns where its result will be.
+  // canonicalize is kept, the evaluation thread calls it.
+  // Called with input_mutex held.
+  Row enqueue(int l, CanonicalizeFn canonicalize, uint64_t hashval, std::span<const int> legal_moves) {
+    auto& lane = lanes[l];
+    Row row = {l, (uint8_t)((lane.index + 1) % 64), lane.size};
+    if (hashval != 0) {
+      // a policy normalized over the legal moves only answers requests with legal moves, and vice versa.
+      auto [it, inserted] = pending_rows.try_emplace(hashval, PendingRow{row, !legal_moves.empty()});
+      if (!inserted && it->second.masked == !legal_moves.empty() && it->second.row.lane == l) {
+        coalesced++;
+        lane.unread[it->second.row.slot]++;
+        return it->second.row;
+      }
+      if (inserted) lane.hashes.push_back(hashval);
+    }
+    lane.canonicalizes.push_back(canonicalize);
+    lane.legal.push_back(legal_moves);
+    lane.size = row.row + 1;
+    lane.unread[row.slot]++;
+    return row;
+  }
+
+  // wakes up the evaluation thread if it sleeps, cheap otherwise.
+  void wake_up() {
+    wakeups++;
+    wakeups.notify_one();
+  }
+
+  static int64_t clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  int bucket_size(int batch_size) const {
+    auto bucket = std::lower_bound(buckets.begin(), buckets.end(), batch_size);
+    return bucket == buckets.end() ? batch_size : *bucket;
+  }
+
+  void warmup_buckets() {
+    std::vector<float> input, v, pi;
+    for (int size : buckets) {
+      input.assign(size * dx, 0);
+      forward(size, input.data(), v, pi);
+    }
+  }
+
+  // callers of the batch have not picked up its results yet, so their legal moves are alive.
+  void postprocess(Output& output) {
+    int v_size = output.v.size() / output.size;
+    const auto& offsets = output.pi_offsets;
+    for (int i = 0; i < output.size; i++) {
+      float* v = output.v.data() + i * v_size;
+      float* pi = output.pi.data() + offsets[i];
+      if (output.compact) {
+        exp_inplace(v, v_size);
+        softmax_inplace(pi, offsets[i + 1] - offsets[i]);
+      } else {
+        postprocess_output(v, v_size, pi, output.pi_size, batch_legal[i]);
+      }
+    }
+  }
+
+  static const float* output_v_row(const Output& output, int row) {
+    return output.v.data() + row * (output.v.size() / output.size);
+  }
+
+  // compact rows are scattered into a per-thread row, only their legal entries are written.
+  static const float* output_pi_row(const Output& output, int row) {
+    const auto& offsets = output.pi_offsets;
+    const float* pi = output.pi.data() + offsets[row];
+    if (!output.compact) {
+      return pi;
+    }
+    thread_local std::vector<float> scattered;
+    scattered.resize(output.pi_size);
+    const int* moves = output.moves.data() + offsets[row];
+    for (int j = 0; j < offsets[row + 1] - offsets[row]; j++) {
+      scattered[moves[j]] = pi[j];
+    }
+    return scattered.data();
+  }
+
+  int dx;
+
+  std::mutex input_mutex;
+  Lane lanes[kPriorityCount];
+  InteractiveLane interactive_lane;
+  // the batch in the evaluation thread, swapped with the pending batch of a lane.
+  std::vector<CanonicalizeFn> batch_canonicalizes;
+  std::vector<std::span<const int>> batch_legal;
+  std::vector<std::pair<int64_t, int>> batch_arrivals;
+  std::vector<uint64_t> batch_hashes;
+  std::vector<float> batch_input;
+  struct PendingRow {
+    Row row;
+    bool masked;  // has legal moves
+  };
+  std::unordered_map<uint64_t, PendingRow> pending_rows;  // by hash, requests pending or in forward()
+  std::vector<int64_t> gather_rows, gather_actions;
+  std::vector<float> full_pi;
+
+  std::unique_ptr<std::thread> eval_thread;
+  std::atomic<bool> stop_eval = true;
+
+  std::mutex swap_mutex, task_mutex;
+  std::function<void()> task;
+  std::atomic<bool> task_pending = false;
+  std::atomic<int64_t> batches_done = 0;  // wakes up wait_any()
+  std::atomic<int> wakeups = 0;
+  DeviceScheduler* device_scheduler = nullptr;  // set and read in the evaluation thread
+  int scheduler_id = 0;
+  std::atomic<int> generation = 0;
+  std::vector<int> buckets;  // written under input_mutex, read by callers in spare_slots()
+  std::atomic<int> free_batch_size = 0;
+
+  Histogram batch_size_histogram, queue_wait_histogram, forward_histogram;
+  std::atomic<int64_t> total_working_input_size = 0, total_padded_size = 0, coalesced = 0, busy_ns = 0,
+      stats_since = 0;
+};
@@ -0,0 +1,410 @@
+#include "core/evaluator/cached.h"
+#include "core/evaluator/queued.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+constexpr std::array<int, 3> kShape = {1, 2, 2};
+constexpr int kPiSize = 8;
+
+// queued evaluator recording the batches it runs, whose forward() can be held
+// to let requests pile up behind a batch. A request's input is its x, the model
+// is a number: v = (0.25, 0.75) on model 0 and (0.75, 0.25) on the others, the
+// policy is the softmax of x * action / 10.
+class ScriptedEvaluator : public QueuedEvaluator {
+ public:
+  struct Batch {
+    int size;
+    std::vector<float> xs;
+    int model;
+  };
+
+  explicit ScriptedEvaluator(DeviceScheduler* scheduler = nullptr) : QueuedEvaluator(kShape) {
+    start();
+    if (scheduler) share_device(*scheduler);
+  }
+
+  ~ScriptedEvaluator() {
+    release();
+    stop();
+  }
+
+  // the next forward() waits until release().
+  void hold() { holding = true; }
+
+  // waits until a forward() is held.
+  void wait_held() { held.wait(false); }
+
+  void release() {
+    holding = false;
+    holding.notify_all();
+  }
+
+  std::vector<Batch> batches() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return recorded;
+  }
+
+  // concurrent forward() calls seen at most, across the evaluators sharing it.
+  static inline std::atomic<int> on_device = 0, max_on_device = 0;
+
+ protected:
+  void forward(int n, const float* input, std::vector<float>& v, std::vector<float>& pi) override {
+    int running = ++on_device;
+    for (int max = max_on_device; running > max && !max_on_device.compare_exchange_weak(max, running);) {
+    }
+    Batch batch = {n, {}, model};
+    for (int i = 0; i < n; i++) batch.xs.push_back(input[i * 4]);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      recorded.push_back(batch);
+    }
+    if (holding) {
+      held = true;
+      held.notify_all();
+      holding.wait(true);
+      held = false;
+    }
+    // the model is read after the hold, a swap must not reach a batch in forward().
+    float p = model == 0 ? 0.25f : 0.75f;
+    v.resize(n * 2);
+    pi.resize(n * kPiSize);
+    for (int i = 0; i < n; i++) {
+      v[i * 2] = std::log(p);
+      v[i * 2 + 1] = std::log(1 - p);
+      // log-softmax outputs, like the networks'
+      float* row = pi.data() + i * kPiSize;
+      double sum = 0;
+      for (int a = 0; a < kPiSize; a++) sum += std::exp(input[i * 4] * a / 10.0);
+      for (int a = 0; a < kPiSize; a++) row[a] = input[i * 4] * a / 10 - std::log(sum);
+    }
+    --on_device;
+  }
+
+  void prepare_model(const std::string& model_path) override { next_model = std::stoi(model_path); }
+
+  void activate_model() override { model = next_model; }
+
+ private:
+  std::atomic<bool> holding = false, held = false;
+  std::mutex mutex;
+  std::vector<Batch> recorded;
+  int model = 0, next_model = 0;
+};
+
+// a request of x, keeping its result.
+struct Request {
+  float x;
+  std::vector<int> legal;
+  std::vector<float> pi, v;
+  int calls = 0;
+
+  void operator()(float* input) const { input[0] = x; }
+
+  void operator()(const float* pi_, const float* v_) {
+    pi.assign(pi_, pi_ + kPiSize);
+    v.assign(v_, v_ + 2);
+    calls++;
+  }
+};
+
+// submits the requests as one ticket.
+void submit(EvaluatorBase* evaluator, Ticket& ticket, std::vector<Request>& requests,
+            const std::vector<uint64_t>& hashvals) {
+  thread_local std::vector<CanonicalizeFn> canonicalizes;
+  thread_local std::vector<ProcessResultFn> process_results;
+  thread_local std::vector<std::span<const int>> legal_moves;
+  canonicalizes.assign(requests.begin(), requests.end());
+  process_results.assign(requests.begin(), requests.end());
+  legal_moves.clear();
+  for (auto& request : requests) legal_moves.push_back(request.legal);
+  evaluator->submit(ticket, requests.size(), canonicalizes.data(), process_results.data(), hashvals.data(),
+                    legal_moves.data());
+}
+
+// whether the request has action a, all actions when it has no legal moves.
+bool has_action(const Request& request, int a) {
+  return request.legal.empty() || std::find(request.legal.begin(), request.legal.end(), a) != request.legal.end();
+}
+
+// checks the policy of a request against the softmax of x * action / 10 over its actions.
+void expect_result(const Request& request) {
+  ASSERT_EQ(request.calls, 1);
+  double sum = 0;
+  for (int a = 0; a < kPiSize; a++) sum += has_action(request, a) ? std::exp(request.x * a / 10.0) : 0;
+  for (int a = 0; a < kPiSize; a++) {
+    if (has_action(request, a)) {
+      EXPECT_NEAR(request.pi[a], std::exp(request.x * a / 10.0) / sum, 1e-5) << "x " << request.x << ", action " << a;
+    }
+  }
+}
+
+}  // namespace
+
+TEST(QueuedEvaluator, CoalescesIdenticalRequests) {
+  ScriptedEvaluator evaluator;
+  // a batch in forward(), the next requests wait in the pending batch.
+  std::vector<Request> blocker = {{1}};
+  Ticket blocker_ticket;
+  evaluator.hold();
+  submit(&evaluator, blocker_ticket, blocker, {0});
+  evaluator.wait_held();
+
+  // the second request of hash 7 rides along the first one, whatever its input.
+  // The same position with legal moves gets its own row.
+  std::vector<Request> first = {{2}}, second = {{5}}, masked = {{2, {1, 3}}};
+  Ticket tickets[3];
+  submit(&evaluator, tickets[0], first, {7});
+  submit(&evaluator, tickets[1], second, {7});
+  submit(&evaluator, tickets[2], masked, {7});
+  evaluator.release();
+  for (auto& ticket : tickets) evaluator.wait(ticket);
+  evaluator.wait(blocker_ticket);
+
+  expect_result(first[0]);
+  expect_result(masked[0]);
+  ASSERT_EQ(second[0].calls, 1);
+  EXPECT_EQ(second[0].pi, first[0].pi);
+  EXPECT_EQ(second[0].v, first[0].v);
+  auto batches = evaluator.batches();
+  ASSERT_EQ(batches.size(), 2);
+  EXPECT_EQ(batches[1].xs, std::vector<float>({2, 2}));
+  EXPECT_EQ(evaluator.stats().coalesced, 1);
+}
+
+TEST(QueuedEvaluator, InteractiveRowsGoAheadOfPendingBulk) {
+  ScriptedEvaluator evaluator;
+  std::vector<Request> blocker = {{1}};
+  Ticket blocker_ticket;
+  evaluator.hold();
+  submit(&evaluator, blocker_ticket, blocker, {0});
+  evaluator.wait_held();
+
+  // bulk rows queued first, the interactive ones still run first.
+  std::vector<Request> bulk = {{10}, {11}}, interactive = {{20}};
+  Ticket bulk_ticket, interactive_ticket;
+  submit(&evaluator, bulk_ticket, bulk, {0, 0});
+  submit(evaluator.interactive(), interactive_ticket, interactive, {0});
+  evaluator.release();
+  evaluator.wait(bulk_ticket);
+  evaluator.wait(interactive_ticket);
+  evaluator.wait(blocker_ticket);
+
+  auto batches = evaluator.batches();
+  ASSERT_EQ(batches.size(), 3);
+  EXPECT_EQ(batches[1].xs, std::vector<float>({20}));
+  EXPECT_EQ(batches[2].xs, std::vector<float>({10, 11}));
+  for (const auto& request : bulk) expect_result(request);
+  expect_result(interactive[0]);
+  EXPECT_EQ(evaluator.stats().latency_us[kInteractive].count, 1);
+}
+
+TEST(QueuedEvaluator, TicketsFinish) {
+  ScriptedEvaluator evaluator;
+  std::vector<Request> blocker = {{1}};
+  Ticket blocker_ticket;
+  evaluator.hold();
+  submit(&evaluator, blocker_ticket, blocker, {0});
+  evaluator.wait_held();
+
+  std::vector<Request> requests = {{2}, {3, {0, 4}}};
+  Ticket ticket;
+  submit(&evaluator, ticket, requests, {0, 0});
+  EXPECT_FALSE(evaluator.poll(blocker_ticket));
+  EXPECT_FALSE(evaluator.poll(ticket));
+  EXPECT_EQ(requests[0].calls, 0);
+  evaluator.release();
+  Ticket* tickets[] = {&ticket, &blocker_ticket};
+  int first = evaluator.wait_any(tickets);
+  EXPECT_TRUE(tickets[first]->finished);
+  evaluator.wait(*tickets[1 - first]);
+  EXPECT_TRUE(evaluator.poll(ticket));
+  for (const auto& request : requests) expect_result(request);
+
+  // tickets are submitted again once finished, each time with other requests.
+  std::vector<std::vector<Request>> rounds(12);
+  Ticket round_tickets[4];
+  for (int i = 0; i < 12; i++) {
+    auto& round_ticket = round_tickets[i % 4];
+    evaluator.wait(round_ticket);
+    rounds[i] = {{(float)i}, {i + 0.5f}};
+    submit(&evaluator, round_ticket, rounds[i], {0, 0});
+  }
+  std::vector<Ticket*> pending = {&round_tickets[0], &round_tickets[1], &round_tickets[2], &round_tickets[3]};
+  while (!pending.empty()) pending.erase(pending.begin() + evaluator.wait_any(pending));
+  for (const auto& round : rounds) {
+    for (const auto& request : round) expect_result(request);
+  }
+}
+
+TEST(QueuedEvaluator, SwapTakesEffectBetweenBatches) {
+  ScriptedEvaluator evaluator;
+  std::vector<Request> blocker = {{1}};
+  Ticket blocker_ticket;
+  evaluator.hold();
+  submit(&evaluator, blocker_ticket, blocker, {0});
+  evaluator.wait_held();
+
+  // the swap waits for the batch in forward() to finish.
+  std::thread swap([&]() { evaluator.swap_model("1"); });
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(evaluator.model_generation(), 0);
+  evaluator.release();
+  swap.join();
+  EXPECT_EQ(evaluator.model_generation(), 1);
+  evaluator.wait(blocker_ticket);
+  EXPECT_FLOAT_EQ(blocker[0].v[0], 0.25f);
+
+  std::vector<Request> after = {{2}};
+  Ticket ticket;
+  submit(&evaluator, ticket, after, {0});
+  evaluator.wait(ticket);
+  EXPECT_FLOAT_EQ(after[0].v[0], 0.75f);
+  expect_result(after[0]);
+  EXPECT_EQ(evaluator.batches().back().model, 1);
+}
+
+TEST(QueuedEvaluator, SearchesSeeOneModelAcrossSwaps) {
+  // searches through a cache, as selfplay_shadow runs them: a search is tagged with
+  // the cache generation, and run again when it changed meanwhile.
+  ScriptedEvaluator evaluator;
+  CachedEvaluator cached(&evaluator, 2, kPiSize, 64);
+  std::mutex mutex;
+  std::vector<int> generation_models = {0};
+  std::atomic<bool> stop = false;
+  std::atomic<int> searches[2] = {0, 0}, mixed = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&, t]() {
+      for (int k = 0; !stop; k++) {
+        int generation = cached.generation(), model;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          model = generation_models[generation];
+        }
+        // a search of 16 evaluations, half of them cached for the other threads.
+        bool other_model = false;
+        for (int i = 0; i < 16; i++) {
+          Request request = {(float)(i % 2 ? t * 100 + k : i)};
+          cached.evaluate(request, request, i % 2 ? 0 : i + 1);
+          other_model |= request.v[0] != (model == 0 ? 0.25f : 0.75f);
+        }
+        if (cached.generation() == generation) {
+          searches[model]++;
+          mixed += other_model;
+        }
+      }
+    });
+  }
+  for (int swap = 1; swap <= 6; swap++) {
+    std::this_thread::sleep_for(20ms);
+    int model = swap % 2;
+    evaluator.swap_model(std::to_string(model), [&]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      cached.clear();
+      generation_models.push_back(model);
+    });
+  }
+  std::this_thread::sleep_for(20ms);
+  stop = true;
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(mixed, 0);
+  EXPECT_GT(searches[0], 0);
+  EXPECT_GT(searches[1], 0);
+}
+
+TEST(QueuedEvaluator, PadsBatchesToBuckets) {
+  ScriptedEvaluator evaluator;
+  // each bucket is warmed up once.
+  evaluator.set_batch_buckets({8, 4});
+  auto batches = evaluator.batches();
+  ASSERT_EQ(batches.size(), 2);
+  EXPECT_EQ(batches[0].size, 4);
+  EXPECT_EQ(batches[1].size, 8);
+  // the padding rows of the next batch are offered to speculative requests.
+  EXPECT_EQ(evaluator.spare_slots(3), 1);
+  EXPECT_EQ(evaluator.spare_slots(9), 0);
+
+  std::vector<Request> three = {{1}, {2}, {3}}, nine(9);
+  for (int i = 0; i < 9; i++) nine[i].x = i;
+  Ticket ticket;
+  submit(&evaluator, ticket, three, {0, 0, 0});
+  evaluator.wait(ticket);
+  submit(&evaluator, ticket, nine, std::vector<uint64_t>(9, 0));
+  evaluator.wait(ticket);
+
+  // padding rows are zeros, larger batches run as they are.
+  batches = evaluator.batches();
+  ASSERT_EQ(batches.size(), 4);
+  EXPECT_EQ(batches[2].xs, std::vector<float>({1, 2, 3, 0}));
+  EXPECT_EQ(batches[3].size, 9);
+  for (const auto& request : three) expect_result(request);
+  for (const auto& request : nine) expect_result(request);
+}
+
+TEST(DeviceScheduler, TurnsFollowWeights) {
+  DeviceScheduler scheduler;
+  // the holder takes a turn between every two turns of the models, long enough for
+  // the model of the last turn to be waiting again. Its virtual time stays at the
+  // current turn, so it gets the device back after each turn of a model.
+  int holder = scheduler.join(), light = scheduler.join(1), heavy = scheduler.join(3);
+  scheduler.acquire(holder);
+  std::mutex mutex;
+  std::vector<int> turns;
+  std::atomic<bool> stopping = false;
+  auto run = [&](int id) {
+    while (!stopping) {
+      scheduler.acquire(id);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        turns.push_back(id);
+      }
+      std::this_thread::sleep_for(2ms);
+      scheduler.release(id, 1000);
+    }
+  };
+  std::thread light_thread(run, light), heavy_thread(run, heavy);
+  for (size_t i = 0; i < 100; i++) {
+    std::this_thread::sleep_for(2ms);
+    scheduler.release(holder, 0);
+    // waits for the turn of a model to start before waiting for the device again.
+    while (true) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (turns.size() > i) break;
+    }
+    scheduler.acquire(holder);
+  }
+  stopping = true;
+  scheduler.release(holder, 0);
+  light_thread.join();
+  heavy_thread.join();
+
+  // the model of weight 3 gets three turns of the same length for each one of the other.
+  ASSERT_GE(turns.size(), 100);
+  EXPECT_NEAR(std::count(turns.begin(), turns.begin() + 100, heavy), 75, 5);
+}
+
+TEST(DeviceScheduler, OneBatchOnTheDeviceAtATime) {
+  DeviceScheduler scheduler;
+  ScriptedEvaluator::on_device = 0;
+  ScriptedEvaluator::max_on_device = 0;
+  ScriptedEvaluator first(&scheduler), second(&scheduler);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&, t]() {
+      auto& evaluator = t % 2 ? first : second;
+      for (int i = 0; i < 50; i++) {
+        std::vector<Request> requests = {{(float)t}, {(float)i}};
+        Ticket ticket;
+        submit(&evaluator, ticket, requests, {0, 0});
+        evaluator.wait(ticket);
+        for (const auto& request : requests) expect_result(request);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(ScriptedEvaluator::max_on_device, 1);
+  EXPECT_GT(first.batches().size(), 0);
+  EXPECT_GT(second.batches().size(), 0);
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+#include "core/util/net.h"
+
+// evaluator running the model on a remote inference server (core/evaluator/remote_server.h),
+// for nodes without accelerators. Each evaluate/evaluateN call is one request frame,
+// concurrent calls are in flight together on the connection and the server batches them.
+// With kInteractive priority, the server batches them ahead of bulk (selfplay) traffic.
+class RemoteEvaluator : public EvaluatorBase {
+ public:
+  RemoteEvaluator(const std::string& host, int port, const std::string& model, const std::array<int, 3>& dimentions,
+                  int v_size_, int pi_size_, Priority priority_ = kBulk)
+      : input_size(dimentions[0] * dimentions[1] * dimentions[2]),
+        v_size(v_size_),
+        pi_size(pi_size_),
+        priority(priority_) {
+    fd = net::connect_to(host, port);
+    if (fd < 0) {
+      std::cerr << "Failed to connect to inference server " << host << ":" << port << std::endl;
+      exit(1);
+    }
+    net::Hello hello = {net::kMagic, net::kVersion, input_size, v_size, pi_size, (uint32_t)model.size()};
+    net::HelloReply reply;
+    if (!net::write_all(fd, &hello, sizeof(hello)) || !net::write_all(fd, model.data(), model.size()) ||
+        !net::read_all(fd, &reply, sizeof(reply)) || reply.magic != net::kMagic || reply.status != net::kOk) {
+      std::cerr << "Inference server " << host << ":" << port << " does not serve " << model << std::endl;
+      exit(1);
+    }
+    reader = std::thread([this]() { receive(); });
+  }
+
+  ~RemoteEvaluator() {
+    stopping = true;
+    shutdown(fd, SHUT_RDWR);
+    reader.join();
+    close(fd);
+  }
+
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    evaluateN(1, &canonicalize, &process_result, &hashval, &legal_moves);
+  }
+
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    // the server takes at most kMaxFrameCount positions per frame
+    for (; N > (int)net::kMaxFrameCount; N -= net::kMaxFrameCount) {
+      evaluateN(net::kMaxFrameCount, canonicalizes, process_results, hashvals, legal_moves);
+      canonicalizes += net::kMaxFrameCount;
+      process_results += net::kMaxFrameCount;
+      if (hashvals) hashvals += net::kMaxFrameCount;
+      if (legal_moves) legal_moves += net::kMaxFrameCount;
+    }
+    auto start = high_resolution_clock::now();
+
+    // encode the request
+    thread_local std::vector<char> frame;
+    size_t legal_total = 0;
+    for (int i = 0; i < N; i++) legal_total += legal_moves ? legal_moves[i].size() : 0;
+    size_t legal_words = (N + legal_total + 1) / 2 * 2;
+    size_t bytes = net::request_bytes(N, legal_total, input_size);
+    frame.assign(sizeof(net::FrameHeader) + bytes, 0);
+    auto hashes = reinterpret_cast<uint64_t*>(frame.data() + sizeof(net::FrameHeader));
+    auto legal_counts = reinterpret_cast<uint16_t*>(hashes + N);
+    auto legal = legal_counts + N;
+    for (int i = 0; i < N; i++) {
+      hashes[i] = hashvals ? hashvals[i] : 0;
+      legal_counts[i] = legal_moves ? legal_moves[i].size() : 0;
+      for (int j = 0; j < legal_counts[i]; j++) *legal++ = legal_moves[i][j];
+    }
+    auto inputs = reinterpret_cast<float*>(legal_counts + legal_words);
+    for (int i = 0; i < N; i++) canonicalizes[i](inputs + (size_t)i * input_size);
+
+    // send it, the reader thread hands the response over
+    Pending pending;
+    uint32_t id = next_id++;
+    *reinterpret_cast<net::FrameHeader*>(frame.data()) = {id, (uint32_t)N, (uint32_t)bytes, (uint32_t)priority};
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex);
+      pendings[id] = &pending;
+    }
+    {
+      std::lock_guard<std::mutex> lock(send_mutex);
+      if (!net::write_all(fd, frame.data(), frame.size())) connection_lost();
+    }
+    pending.done.wait(false);
+    if (pending.payload.empty()) connection_lost();
+
+    // decode the response
+    thread_local std::vector<float> pi;
+    pi.resize(pi_size);
+    const float* p = reinterpret_cast<const float*>(pending.payload.data());
+    for (int i = 0; i < N; i++) {
+      const float* v = p;
+      p += v_size;
+      if (legal_moves && !legal_moves[i].empty()) {
+        for (int move : legal_moves[i]) pi[move] = *p++;
+      } else {
+        std::copy(p, p + pi_size, pi.begin());
+        p += pi_size;
+      }
+      process_results[i](pi.data(), v);
+    }
+
+    auto rtt = duration_cast<std::chrono::microseconds>(high_resolution_clock::now() - start).count();
+    batch_size_histogram.add(N);
+    rtt_histogram.add(rtt);
+    request_count++;
+    item_count += N;
+    total_rtt_us += rtt;
+    for (int64_t max = max_rtt_us; rtt > max && !max_rtt_us.compare_exchange_weak(max, rtt);) {
+    }
+  }
+
+  // the round trip of each request is reported as its forward time.
+  EvaluatorStats stats() {
+    EvaluatorStats stats;
+    stats.seconds = std::chrono::duration<double>(high_resolution_clock::now() - stats_since.load()).count();
+    stats.requests = item_count;
+    stats.batch_size = batch_size_histogram.snapshot();
+    stats.forward_us = rtt_histogram.snapshot();
+    return stats;
+  }
+
+  void reset_stats() {
+    batch_size_histogram.reset();
+    rtt_histogram.reset();
+    request_count = 0;
+    item_count = 0;
+    total_rtt_us = 0;
+    max_rtt_us = 0;
+    stats_since = high_resolution_clock::now();
+  }
+
+  std::string statistics() {
+    std::stringstream ss;
+    int64_t requests = std::max<int64_t>(1, request_count);
+    ss << "Requests: " << request_count << ", average batch size: " << item_count / (double)requests
+       << ", average round trip: " << total_rtt_us / 1000.0 / requests << "ms, max round trip: "
+       << max_rtt_us / 1000.0 << "ms";
+    return ss.str();
+  }
+
+ private:
+  struct Pending {
+    std::vector<char> payload;
+    std::atomic<bool> done = false;
+  };
+
+  [[noreturn]] void connection_lost() {
+    std::cerr << "Connection to inference server lost." << std::endl;
+    exit(1);
+  }
+
+  void receive() {
+    net::FrameHeader header;
+    while (net::read_all(fd, &header, sizeof(header))) {
+      std::vector<char> payload(header.bytes);
+      if (!net::read_all(fd, payload.data(), payload.size())) break;
+      Pending* pending;
+      {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        auto it = pendings.find(header.id);
+        if (it == pendings.end()) continue;
+        pending = it->second;
+        pendings.erase(it);
+      }
+      pending->payload = std::move(payload);
+      pending->done = true;
+      pending->done.notify_one();
+    }
+    if (!stopping) connection_lost();
+  }
+
+  int input_size, v_size, pi_size;
+  Priority priority;
+  int fd;
+  std::thread reader;
+  std::atomic<bool> stopping = false;
+
+  std::mutex send_mutex;
+  std::mutex pending_mutex;
+  std::map<uint32_t, Pending*> pendings;
+  std::atomic<uint32_t> next_id = 0;
+
+  Histogram batch_size_histogram, rtt_histogram;
+  std::atomic<int64_t> request_count = 0, item_count = 0, total_rtt_us = 0, max_rtt_us = 0;
+  std::atomic<high_resolution_clock::time_point> stats_since = high_resolution_clock::now();
+};
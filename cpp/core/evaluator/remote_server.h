@@ -0,0 +1,237 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+#include "core/util/net.h"
+
+// server side of the remote inference backend, see core/util/net.h.
+// Serves any evaluators by model name. Request frames of a connection are run by
+// several worker threads, so concurrent frames of all clients reach the wrapped
+// evaluators together and a queued evaluator batches them.
+// Frames are checked against the protocol before they reach the evaluators, a
+// client breaking it is disconnected.
+class RemoteServer {
+ public:
+  RemoteServer(std::map<std::string, EvaluatorBase*> evaluators_, const std::array<int, 3>& dimentions, int v_size_,
+               int pi_size_, int workers_per_connection_ = 8)
+      : evaluators(std::move(evaluators_)),
+        input_size(dimentions[0] * dimentions[1] * dimentions[2]),
+        v_size(v_size_),
+        pi_size(pi_size_),
+        workers_per_connection(workers_per_connection_) {}
+
+  // Listens on address, "localhost" by default so that only the processes of this
+  // host connect, returns the port (port 0 picks a free one).
+  int listen(int port, const std::string& address = "localhost") {
+    listen_fd = net::listen_on(address, port);
+    if (listen_fd < 0) {
+      std::cerr << "Failed to listen on " << address << ":" << port << std::endl;
+      exit(1);
+    }
+    return net::local_port(listen_fd);
+  }
+
+  // Accepts connections until stop is set, then disconnects the clients still
+  // connected and waits for their handlers.
+  void serve(const std::atomic<bool>& stop) {
+    while (!stop) {
+      pollfd pfd = {listen_fd, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0) continue;
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) continue;
+      net::set_nodelay(fd);
+      {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        connections.push_back(fd);
+      }
+      std::thread([this, fd]() { connection(fd); }).detach();
+    }
+    close(listen_fd);
+    std::unique_lock<std::mutex> lock(connections_mutex);
+    for (int fd : connections) shutdown(fd, SHUT_RDWR);
+    connections_cv.wait(lock, [&]() { return connections.empty(); });
+  }
+
+  std::string statistics() {
+    std::stringstream ss;
+    ss << "Frames: " << frame_count
+       << ", average frame size: " << item_count / (double)std::max<int64_t>(1, frame_count);
+    return ss.str();
+  }
+
+ private:
+  struct Frame {
+    net::FrameHeader header;
+    std::vector<char> payload;
+  };
+
+  // a position of a request frame, its canonicalize copies the input from the
+  // frame and its process_result writes the response row.
+  struct Request {
+    const RemoteServer* server;
+    const float* input;
+    float* row;
+    std::span<const int> legal;
+
+    void operator()(float* x) const { std::copy(input, input + server->input_size, x); }
+
+    void operator()(const float* pi, const float* v) const {
+      std::copy(v, v + server->v_size, row);
+      if (legal.empty()) {
+        std::copy(pi, pi + server->pi_size, row + server->v_size);
+      } else {
+        for (size_t j = 0; j < legal.size(); j++) row[server->v_size + j] = pi[legal[j]];
+      }
+    }
+  };
+
+  // handler thread of a connection, it closes the socket when done. The socket is
+  // closed and the server notified under the lock, serve() never shuts down a
+  // reused fd and may return as soon as the list is empty.
+  void connection(int fd) {
+    handle(fd);
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connections.erase(std::find(connections.begin(), connections.end(), fd));
+    close(fd);
+    connections_cv.notify_all();
+  }
+
+  // Serves a connection until it is closed or breaks the protocol.
+  void handle(int fd) {
+    net::Hello hello;
+    std::string name;
+    if (!net::read_all(fd, &hello, sizeof(hello)) || hello.magic != net::kMagic || hello.version != net::kVersion ||
+        hello.name_size > net::kMaxNameSize) {
+      return;
+    }
+    name.resize(hello.name_size);
+    if (!net::read_all(fd, name.data(), name.size())) return;
+
+    net::HelloReply reply = {net::kMagic, net::kVersion, net::kOk};
+    auto it = evaluators.find(name);
+    if (it == evaluators.end()) {
+      reply.status = net::kUnknownModel;
+    } else if (hello.input_size != input_size || hello.v_size != v_size || hello.pi_size != pi_size) {
+      reply.status = net::kShapeMismatch;
+    }
+    if (!net::write_all(fd, &reply, sizeof(reply)) || reply.status != net::kOk) return;
+    EvaluatorBase* evaluator = it->second;
+
+    std::mutex queue_mutex, send_mutex;
+    std::condition_variable queue_cv, space_cv;
+    std::queue<Frame> queue;
+    bool closed = false;
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workers_per_connection; i++) {
+      workers.emplace_back([&]() {
+        for (;;) {
+          Frame frame;
+          {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [&]() { return closed || !queue.empty(); });
+            if (queue.empty()) return;
+            frame = std::move(queue.front());
+            queue.pop();
+          }
+          space_cv.notify_one();
+          auto response = run(frame.header.priority == kInteractive ? evaluator->interactive() : evaluator, frame);
+          std::lock_guard<std::mutex> lock(send_mutex);
+          net::write_all(fd, response.data(), response.size());
+        }
+      });
+    }
+
+    // at most max_queued frames wait for a worker, then the client is not read
+    // and tcp flow control holds it back.
+    const size_t max_queued = 2 * workers_per_connection;
+    Frame frame;
+    while (net::read_all(fd, &frame.header, sizeof(frame.header))) {
+      size_t count = frame.header.count;
+      if (count > net::kMaxFrameCount || frame.header.bytes > net::request_bytes(count, count * pi_size, input_size)) {
+        break;
+      }
+      frame.payload.resize(frame.header.bytes);
+      if (!net::read_all(fd, frame.payload.data(), frame.payload.size()) || !valid(frame)) break;
+      std::unique_lock<std::mutex> lock(queue_mutex);
+      space_cv.wait(lock, [&]() { return queue.size() < max_queued; });
+      queue.push(std::move(frame));
+      queue_cv.notify_one();
+    }
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      closed = true;
+    }
+    queue_cv.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+
+  // whether the payload has the size its header and legal move counts give, and
+  // the legal moves are actions.
+  bool valid(const Frame& frame) {
+    size_t n = frame.header.count;
+    if (frame.payload.size() < n * (sizeof(uint64_t) + sizeof(uint16_t))) return false;
+    auto legal_counts = reinterpret_cast<const uint16_t*>(frame.payload.data() + n * sizeof(uint64_t));
+    size_t legal_total = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (legal_counts[i] > pi_size) return false;
+      legal_total += legal_counts[i];
+    }
+    if (frame.payload.size() != net::request_bytes(n, legal_total, input_size)) return false;
+    for (size_t j = 0; j < legal_total; j++) {
+      if (legal_counts[n + j] >= pi_size) return false;
+    }
+    return true;
+  }
+
+  // decodes a request frame, evaluates it and encodes the response frame.
+  std::vector<char> run(EvaluatorBase* evaluator, const Frame& frame) {
+    int n = frame.header.count;
+    auto hashes = reinterpret_cast<const uint64_t*>(frame.payload.data());
+    auto legal_counts = reinterpret_cast<const uint16_t*>(hashes + n);
+    size_t legal_total = 0;
+    for (int i = 0; i < n; i++) legal_total += legal_counts[i];
+    size_t legal_words = (n + legal_total + 1) / 2 * 2;
+    auto inputs = reinterpret_cast<const float*>(legal_counts + legal_words);
+
+    // legal moves are widened to int for the evaluators.
+    std::vector<int> legal(legal_counts + n, legal_counts + n + legal_total);
+    std::vector<Request> requests;
+    size_t legal_offset = 0, response_size = 0;
+    for (int i = 0; i < n; i++) {
+      requests.push_back({this, inputs + (size_t)i * input_size, nullptr,
+                          {legal.data() + legal_offset, legal_counts[i]}});
+      legal_offset += legal_counts[i];
+      response_size += v_size + (legal_counts[i] ? legal_counts[i] : pi_size);
+    }
+
+    std::vector<char> response(sizeof(net::FrameHeader) + response_size * sizeof(float));
+    *reinterpret_cast<net::FrameHeader*>(response.data()) = {frame.header.id, (uint32_t)n,
+                                                             (uint32_t)(response_size * sizeof(float)),
+                                                             frame.header.priority};
+    auto out = reinterpret_cast<float*>(response.data() + sizeof(net::FrameHeader));
+    std::vector<std::span<const int>> legal_moves;
+    for (auto& request : requests) {
+      request.row = out;
+      out += v_size + (request.legal.empty() ? pi_size : request.legal.size());
+      legal_moves.push_back(request.legal);
+    }
+    std::vector<CanonicalizeFn> canonicalizes(requests.begin(), requests.end());
+    std::vector<ProcessResultFn> process_results(requests.begin(), requests.end());
+    evaluator->evaluateN(n, canonicalizes.data(), process_results.data(), hashes, legal_moves.data());
+
+    frame_count++;
+    item_count += n;
+    return response;
+  }
+
+  std::map<std::string, EvaluatorBase*> evaluators;
+  int input_size, v_size, pi_size;
+  int workers_per_connection;
+  int listen_fd = -1;
+
+  std::mutex connections_mutex;
+  std::condition_variable connections_cv;
+  std::vector<int> connections;  // sockets of the live connections
+
+  std::atomic<int64_t> frame_count = 0, item_count = 0;
+};
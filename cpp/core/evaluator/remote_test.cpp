@@ -0,0 +1,165 @@
+#include "core/evaluator/remote_client.h"
+#include "core/evaluator/remote_server.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+constexpr std::array<int, 3> kShape = {2, 2, 2};
+constexpr int kPiSize = 16;
+
+// v = (input[0], hash), pi[a] = input[0] + a
+class EchoEvaluator : public EvaluatorBase {
+ public:
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    float input[8] = {0}, v[2], pi[kPiSize];
+    canonicalize(input);
+    v[0] = input[0];
+    v[1] = hashval;
+    for (int a = 0; a < kPiSize; a++) pi[a] = input[0] + a;
+    process_result(pi, v);
+  }
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    for (int i = 0; i < N; i++) {
+      evaluate(canonicalizes[i], process_results[i], hashvals ? hashvals[i] : 0,
+               legal_moves ? legal_moves[i] : std::span<const int>{});
+    }
+  }
+};
+
+}  // namespace
+
+TEST(RemoteEvaluator, LoopbackRoundTrip) {
+  EchoEvaluator echo;
+  RemoteServer server({{"echo", &echo}}, kShape, 2, kPiSize);
+  int port = server.listen(0);
+  std::atomic<bool> stop = false;
+  std::thread server_thread([&]() { server.serve(stop); });
+
+  {
+    RemoteEvaluator evaluator("localhost", port, "echo", kShape, 2, kPiSize);
+    std::atomic<int> errors = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&, t]() {
+        for (int k = 0; k < 200; k++) {
+          float x = t * 1000 + k;
+          // one position with legal moves, one without
+          std::vector<int> legal = {k % kPiSize, (k + 3) % kPiSize};
+          std::function<void(float*)> canonicalizes[2] = {[x](float* in) { in[0] = x; },
+                                                          [x](float* in) { in[0] = -x; }};
+          std::function<void(const float*, const float*)> process_results[2] = {
+              [&, x](const float* pi, const float* v) {
+                if (v[0] != x || v[1] != 7 || pi[legal[0]] != x + legal[0] || pi[legal[1]] != x + legal[1]) errors++;
+              },
+              [&, x](const float* pi, const float* v) {
+                for (int a = 0; a < kPiSize; a++) {
+                  if (pi[a] != -x + a) errors++;
+                }
+                if (v[0] != -x || v[1] != 0) errors++;
+              }};
+          uint64_t hashvals[2] = {7, 0};
+          std::span<const int> legal_moves[2] = {legal, {}};
+          CanonicalizeFn canonicalize_fns[2] = {canonicalizes[0], canonicalizes[1]};
+          ProcessResultFn process_result_fns[2] = {process_results[0], process_results[1]};
+          evaluator.evaluateN(2, canonicalize_fns, process_result_fns, hashvals, legal_moves);
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    EXPECT_EQ(errors, 0);
+    EXPECT_NE(evaluator.statistics().find("Requests: 800"), std::string::npos);
+  }
+
+  stop = true;
+  server_thread.join();
+}
+
+TEST(RemoteEvaluator, ServerClosesMalformedFrames) {
+  EchoEvaluator echo;
+  RemoteServer server({{"echo", &echo}}, kShape, 2, kPiSize);
+  int port = server.listen(0);
+  std::atomic<bool> stop = false;
+  std::thread server_thread([&]() { server.serve(stop); });
+
+  // a well formed hello, then a frame whose legal move is not an action
+  auto send_frame = [&](std::vector<char> payload, uint32_t count) {
+    int fd = net::connect_to("localhost", port);
+    EXPECT_GE(fd, 0);
+    std::string name = "echo";
+    net::Hello hello = {net::kMagic, net::kVersion, 8, 2, kPiSize, (uint32_t)name.size()};
+    net::HelloReply reply;
+    EXPECT_TRUE(net::write_all(fd, &hello, sizeof(hello)) && net::write_all(fd, name.data(), name.size()) &&
+                net::read_all(fd, &reply, sizeof(reply)));
+    EXPECT_EQ(reply.status, net::kOk);
+    net::FrameHeader header = {0, count, (uint32_t)payload.size(), 0};
+    net::write_all(fd, &header, sizeof(header));
+    net::write_all(fd, payload.data(), payload.size());
+    // the connection is closed without a response
+    bool answered = net::read_all(fd, &header, sizeof(header));
+    close(fd);
+    return answered;
+  };
+  std::vector<char> payload(net::request_bytes(1, 1, 8), 0);
+  reinterpret_cast<uint16_t*>(payload.data() + 8)[0] = 1;  // legal count
+  reinterpret_cast<uint16_t*>(payload.data() + 8)[1] = kPiSize;
+  EXPECT_FALSE(send_frame(payload, 1));
+  // legal count larger than the payload
+  reinterpret_cast<uint16_t*>(payload.data() + 8)[0] = 9;
+  reinterpret_cast<uint16_t*>(payload.data() + 8)[1] = 0;
+  EXPECT_FALSE(send_frame(payload, 1));
+  // too many positions
+  EXPECT_FALSE(send_frame(payload, net::kMaxFrameCount + 1));
+  // the same frame, valid, is answered
+  reinterpret_cast<uint16_t*>(payload.data() + 8)[0] = 1;
+  EXPECT_TRUE(send_frame(payload, 1));
+
+  stop = true;
+  server_thread.join();
+}
+
+TEST(RemoteEvaluator, ServerReleasesClosedConnections) {
+  EchoEvaluator echo;
+  RemoteServer server({{"echo", &echo}}, kShape, 2, kPiSize);
+  int port = server.listen(0);
+  std::atomic<bool> stop = false;
+  std::thread server_thread([&]() { server.serve(stop); });
+
+  auto open_fds = []() {
+    return std::distance(std::filesystem::directory_iterator("/proc/self/fd"), std::filesystem::directory_iterator());
+  };
+  auto before = open_fds();
+  // clients coming and going: evaluating, refused for an unknown model, or gone before the hello.
+  for (int i = 0; i < 200; i++) {
+    if (i % 3 == 0) {
+      RemoteEvaluator evaluator("localhost", port, "echo", kShape, 2, kPiSize);
+      float pi[kPiSize], v[2];
+      evaluator.evaluate([](float* input) { input[0] = 1; },
+                         [&](const float* pi_, const float* v_) {
+                           std::copy(pi_, pi_ + kPiSize, pi);
+                           std::copy(v_, v_ + 2, v);
+                         });
+      EXPECT_EQ(v[0], 1);
+    } else {
+      int fd = net::connect_to("localhost", port);
+      ASSERT_GE(fd, 0);
+      if (i % 3 == 1) {
+        std::string name = "unknown";
+        net::Hello hello = {net::kMagic, net::kVersion, 8, 2, kPiSize, (uint32_t)name.size()};
+        net::HelloReply reply;
+        net::write_all(fd, &hello, sizeof(hello));
+        net::write_all(fd, name.data(), name.size());
+        EXPECT_TRUE(net::read_all(fd, &reply, sizeof(reply)));
+        EXPECT_EQ(reply.status, net::kUnknownModel);
+      }
+      close(fd);
+    }
+  }
+  // the handlers close their sockets shortly after the clients.
+  for (int i = 0; i < 100 && open_fds() > before; i++) std::this_thread::sleep_for(10ms);
+  EXPECT_EQ(open_fds(), before);
+
+  stop = true;
+  server_thread.join();
+}
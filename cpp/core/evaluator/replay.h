@@ -0,0 +1,234 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+#include "core/util/xxhash64.h"
+
+// Recording and replay of evaluations, to re-run real searches against real
+// network outputs without the network.
+//
+// File format: a RecordHeader, then one record per evaluation:
+//   uint64 key, uint16 legal_count, uint16 legal moves[legal_count],
+//   float v[v_size], float pi[legal_count] (only the legal moves, or pi[pi_size]
+//   when no legal moves were given), float input[input_size] (with kRecordInputs).
+// The key is the position hash of the request, or the hash of its canonical
+// input when the request has none. All values are little endian.
+namespace replay {
+
+constexpr uint32_t kMagic = 0x52525a53;  // "SZRR"
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kRecordInputs = 1;
+
+struct RecordHeader {
+  uint32_t magic, version;
+  int32_t input_size, v_size, pi_size;
+  uint32_t flags;
+};
+
+inline uint64_t input_key(const float* input, int input_size) {
+  return XXHash64::hash(input, input_size * sizeof(float), 0);
+}
+
+}  // namespace replay
+
+// evaluator wrapper writing every evaluation of the wrapped evaluator to a file.
+class RecordingEvaluator : public EvaluatorBase {
+ public:
+  RecordingEvaluator(EvaluatorBase* evaluator_, const std::string& path, const std::array<int, 3>& dimentions,
+                     int v_size_, int pi_size_, bool record_inputs_ = true)
+      : evaluator(evaluator_),
+        input_size(dimentions[0] * dimentions[1] * dimentions[2]),
+        v_size(v_size_),
+        pi_size(pi_size_),
+        record_inputs(record_inputs_),
+        out(path, std::ios::binary | std::ios::trunc) {
+    if (!out) {
+      std::cerr << "Failed to open " << path << " to record evaluations." << std::endl;
+      exit(1);
+    }
+    replay::RecordHeader header = {replay::kMagic, replay::kVersion,   input_size, v_size,
+                                   pi_size,        record_inputs ? replay::kRecordInputs : 0};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    evaluateN(1, &canonicalize, &process_result, &hashval, &legal_moves);
+  }
+
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    // the canonical inputs are kept aside while the wrapped evaluator fills them. Requests
+    // it answers without canonicalizing (cached or coalesced) were recorded before.
+    std::vector<float> inputs((size_t)N * input_size);
+    std::vector<char> filled(N, false);
+    std::vector<std::function<void(float*)>> recorded_canonicalizes(N);
+    std::vector<std::function<void(const float*, const float*)>> recorded_process_results(N);
+    for (int i = 0; i < N; i++) {
+      float* input = inputs.data() + (size_t)i * input_size;
+      recorded_canonicalizes[i] = [this, input, &filled = filled[i], &canonicalize = canonicalizes[i]](float* storage) {
+        canonicalize(storage);
+        std::copy(storage, storage + input_size, input);
+        filled = true;
+      };
+      auto hashval = hashvals ? hashvals[i] : 0;
+      auto legal = legal_moves ? legal_moves[i] : std::span<const int>{};
+      recorded_process_results[i] = [this, input, hashval, legal, &filled = filled[i],
+                                     &process_result = process_results[i]](const float* pi, const float* v) {
+        if (filled) write(hashval ? hashval : replay::input_key(input, input_size), legal, v, pi, input);
+        process_result(pi, v);
+      };
+    }
+    std::vector<CanonicalizeFn> canonicalize_fns(recorded_canonicalizes.begin(), recorded_canonicalizes.end());
+    std::vector<ProcessResultFn> process_result_fns(recorded_process_results.begin(), recorded_process_results.end());
+    evaluator->evaluateN(N, canonicalize_fns.data(), process_result_fns.data(), hashvals, legal_moves);
+  }
+
+  EvaluatorStats stats() { return evaluator->stats(); }
+
+  void reset_stats() { evaluator->reset_stats(); }
+
+  int spare_slots(int n) { return evaluator->spare_slots(n); }
+
+ private:
+  void write(uint64_t key, std::span<const int> legal, const float* v, const float* pi, const float* input) {
+    std::lock_guard<std::mutex> lock(out_mutex);
+    uint16_t legal_count = legal.size();
+    out.write(reinterpret_cast<const char*>(&key), sizeof(key));
+    out.write(reinterpret_cast<const char*>(&legal_count), sizeof(legal_count));
+    for (int move : legal) {
+      uint16_t m = move;
+      out.write(reinterpret_cast<const char*>(&m), sizeof(m));
+    }
+    out.write(reinterpret_cast<const char*>(v), v_size * sizeof(float));
+    if (legal.empty()) {
+      out.write(reinterpret_cast<const char*>(pi), pi_size * sizeof(float));
+    } else {
+      for (int move : legal) out.write(reinterpret_cast<const char*>(pi + move), sizeof(float));
+    }
+    if (record_inputs) out.write(reinterpret_cast<const char*>(input), input_size * sizeof(float));
+  }
+
+  EvaluatorBase* evaluator;
+  int input_size, v_size, pi_size;
+  bool record_inputs;
+
+  std::mutex out_mutex;
+  std::ofstream out;
+};
+
+// evaluator serving the evaluations of a recording from memory.
+// Requests that were not recorded are passed to the fallback evaluator, or get
+// uniform outputs without one. Hits and misses are reported as cache stats.
+class ReplayEvaluator : public EvaluatorBase {
+ public:
+  explicit ReplayEvaluator(const std::string& path, EvaluatorBase* fallback_ = nullptr) : fallback(fallback_) {
+    std::ifstream in(path, std::ios::binary);
+    replay::RecordHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != replay::kMagic ||
+        header.version != replay::kVersion) {
+      std::cerr << "Failed to read the recording " << path << std::endl;
+      exit(1);
+    }
+    input_size = header.input_size;
+    v_size = header.v_size;
+    pi_size = header.pi_size;
+
+    std::vector<float> input(input_size);
+    for (;;) {
+      uint64_t key;
+      uint16_t legal_count;
+      if (!in.read(reinterpret_cast<char*>(&key), sizeof(key)) ||
+          !in.read(reinterpret_cast<char*>(&legal_count), sizeof(legal_count))) {
+        break;
+      }
+      Entry entry;
+      entry.legal.resize(legal_count);
+      entry.values.resize(v_size + (legal_count ? legal_count : pi_size));
+      in.read(reinterpret_cast<char*>(entry.legal.data()), legal_count * sizeof(uint16_t));
+      in.read(reinterpret_cast<char*>(entry.values.data()), entry.values.size() * sizeof(float));
+      if (header.flags & replay::kRecordInputs) {
+        in.read(reinterpret_cast<char*>(input.data()), input_size * sizeof(float));
+      }
+      if (!in) break;
+      entries.try_emplace(key, std::move(entry));
+    }
+    std::cout << "Replaying " << entries.size() << " positions from " << path << std::endl;
+  }
+
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    uint64_t key = hashval;
+    if (key == 0) {
+      thread_local std::vector<float> input;
+      input.assign(input_size, 0);
+      canonicalize(input.data());
+      key = replay::input_key(input.data(), input_size);
+    }
+
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+      misses++;
+      if (fallback) {
+        fallback->evaluate(canonicalize, process_result, hashval, legal_moves);
+      } else {
+        uniform(process_result, legal_moves);
+      }
+      return;
+    }
+    hits++;
+
+    // recorded policies only hold the recorded legal moves, the same for every request of the position.
+    const auto& entry = it->second;
+    thread_local std::vector<float> pi;
+    pi.assign(pi_size, 0);
+    const float* recorded_pi = entry.values.data() + v_size;
+    if (entry.legal.empty()) {
+      std::copy(recorded_pi, recorded_pi + pi_size, pi.begin());
+    } else {
+      for (size_t j = 0; j < entry.legal.size(); j++) pi[entry.legal[j]] = recorded_pi[j];
+    }
+    process_result(pi.data(), entry.values.data());
+  }
+
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    for (int i = 0; i < N; i++) {
+      evaluate(canonicalizes[i], process_results[i], hashvals ? hashvals[i] : 0,
+               legal_moves ? legal_moves[i] : std::span<const int>{});
+    }
+  }
+
+  EvaluatorStats stats() {
+    EvaluatorStats stats;
+    stats.requests = hits + misses;
+    stats.cache_hits = hits;
+    stats.cache_misses = misses;
+    return stats;
+  }
+
+  void reset_stats() {
+    hits = 0;
+    misses = 0;
+  }
+
+ private:
+  struct Entry {
+    std::vector<uint16_t> legal;
+    std::vector<float> values;  // v then pi
+  };
+
+  void uniform(ProcessResultFn process_result, std::span<const int> legal_moves) {
+    std::vector<float> v(v_size, 1.0f / v_size), pi(pi_size, 0.0f);
+    if (legal_moves.empty()) {
+      std::fill(pi.begin(), pi.end(), 1.0f / pi_size);
+    } else {
+      for (int move : legal_moves) pi[move] = 1.0f / legal_moves.size();
+    }
+    process_result(pi.data(), v.data());
+  }
+
+  EvaluatorBase* fallback;
+  int input_size, v_size, pi_size;
+  std::unordered_map<uint64_t, Entry> entries;
+  std::atomic<int64_t> hits = 0, misses = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+#include "core/util/shm.h"
+
+// client of the local inference server (cmd/serve_shadow.cpp), see core/util/shm.h.
+// Positions of every process using the same model are batched together by the server.
+class SharedMemoryEvaluator : public EvaluatorBase {
+ public:
+  SharedMemoryEvaluator(const std::string& model_path, const std::array<int, 3>& dimentions, int output_action_size,
+                        int timeout_ms = 60000) {
+    auto name = shm::channel_name(model_path);
+    channel = shm::Channel::open(name, timeout_ms);
+    if (!channel) {
+      std::cerr << "No inference server for " << model_path << " (" << name << ")" << std::endl;
+      exit(1);
+    }
+    auto header = channel->header();
+    if (header->input_size != dimentions[0] * dimentions[1] * dimentions[2] || header->pi_size != output_action_size) {
+      std::cerr << "Inference server of " << model_path << " serves another game." << std::endl;
+      exit(1);
+    }
+  }
+
+  void evaluate(CanonicalizeFn canonicalize, ProcessResultFn process_result, uint64_t hashval = 0,
+                std::span<const int> legal_moves = {}) {
+    int slot = acquire();
+    fill(slot, canonicalize, hashval, legal_moves);
+    submit();
+    process_result(finish(slot), channel->v(slot));
+    release(slot);
+  }
+
+  // Positions are sent in chunks of the slots free at the time, each chunk is
+  // finished and its slots released before the next one claims any, so clients
+  // never wait for slots while holding some.
+  void evaluateN(int N, const CanonicalizeFn* canonicalizes, const ProcessResultFn* process_results,
+                 const uint64_t* hashvals = nullptr, const std::span<const int>* legal_moves = nullptr) {
+    thread_local std::vector<int> slots;
+    for (int begin = 0; begin < N; begin += slots.size()) {
+      slots.assign(1, acquire());
+      for (int slot; begin + (int)slots.size() < N && (slot = try_acquire()) >= 0;) slots.push_back(slot);
+      for (size_t k = 0; k < slots.size(); k++) {
+        int i = begin + k;
+        fill(slots[k], canonicalizes[i], hashvals ? hashvals[i] : 0,
+             legal_moves ? legal_moves[i] : std::span<const int>{});
+      }
+      submit();
+      for (size_t k = 0; k < slots.size(); k++) {
+        process_results[begin + k](finish(slots[k]), channel->v(slots[k]));
+        release(slots[k]);
+      }
+    }
+  }
+
+ private:
+  // claims a free slot, sleeps a little when the server is saturated.
+  int acquire() {
+    for (;;) {
+      int slot = try_acquire();
+      if (slot >= 0) return slot;
+      std::this_thread::sleep_for(100us);
+    }
+  }
+
+  // claims a free slot, returns -1 when there is none.
+  int try_acquire() {
+    int count = channel->header()->slot_count;
+    for (int n = 0; n < count; n++) {
+      int i = cursor.fetch_add(1) % count;
+      uint32_t expected = shm::kFree;
+      if (channel->slot(i)->state.compare_exchange_strong(expected, shm::kWriting)) {
+        channel->slot(i)->owner = pid;
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void fill(int slot, CanonicalizeFn canonicalize, uint64_t hashval, std::span<const int> legal_moves) {
+    auto header = channel->slot(slot);
+    std::fill(channel->input(slot), channel->input(slot) + channel->header()->input_size, 0.0f);
+    canonicalize(channel->input(slot));
+    std::copy(legal_moves.begin(), legal_moves.end(), channel->legal(slot));
+    header->legal_count = legal_moves.size();
+    header->hashval = hashval;
+    header->state = shm::kReady;
+  }
+
+  void submit() {
+    channel->header()->pending++;
+    shm::wake_all(channel->header()->pending);
+  }
+
+  // waits for the outputs of a slot, returns its policy.
+  const float* finish(int slot) {
+    auto& state = channel->slot(slot)->state;
+    auto header = channel->header();
+    for (uint32_t s; (s = state) != shm::kDone;) {
+      // a crashed server leaves serving set, it is looked for when a wait times out.
+      bool woken = shm::wait(state, s, 1000);
+      if (!header->serving || (!woken && !shm::alive(header->server_pid))) {
+        std::cerr << "Inference server stopped." << std::endl;
+        exit(1);
+      }
+    }
+    return channel->pi(slot);
+  }
+
+  void release(int slot) { channel->slot(slot)->state = shm::kFree; }
+
+  std::unique_ptr<shm::Channel> channel;
+  std::atomic<uint32_t> cursor = 0;
+  int32_t pid = getpid();
+};
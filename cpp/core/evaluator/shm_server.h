@@ -0,0 +1,131 @@
+#pragma once
+
+#include "core/evaluator/base.h"
+#include "core/util/shm.h"
+
+// server side of a shared-memory channel, see core/util/shm.h.
+// Every ready slot of the channel is sent to the wrapped evaluator as one evaluateN call,
+// requests arriving meanwhile make up the next batch.
+class SharedMemoryServer {
+ public:
+  SharedMemoryServer(EvaluatorBase* evaluator_, const std::string& name, const std::array<int, 3>& dimentions,
+                     int v_size, int pi_size, int slot_count)
+      : evaluator(evaluator_),
+        channel(shm::Channel::create(name, dimentions[0] * dimentions[1] * dimentions[2], v_size, pi_size,
+                                     slot_count)) {}
+
+  // Serves requests until stop is set.
+  void serve(const std::atomic<bool>& stop) {
+    auto header = channel->header();
+    std::vector<int> batch;
+    std::vector<Request> requests;
+    std::vector<CanonicalizeFn> canonicalize_fns;
+    std::vector<ProcessResultFn> process_result_fns;
+    std::vector<uint64_t> hashvals;
+    std::vector<std::span<const int>> legal_moves;
+
+    header->serving = 1;
+    auto last_reclaim = std::chrono::steady_clock::now();
+    while (!stop) {
+      if (std::chrono::steady_clock::now() - last_reclaim > 1s) {
+        reclaim_slots();
+        last_reclaim = std::chrono::steady_clock::now();
+      }
+      uint32_t pending = header->pending;
+      batch.clear();
+      for (int i = 0; i < header->slot_count; i++) {
+        uint32_t expected = shm::kReady;
+        if (channel->slot(i)->state.compare_exchange_strong(expected, shm::kServing)) {
+          batch.push_back(i);
+        }
+      }
+      if (batch.empty()) {
+        shm::wait(header->pending, pending, 100);
+        continue;
+      }
+
+      requests.clear();
+      hashvals.clear();
+      legal_moves.clear();
+      for (int slot : batch) {
+        requests.push_back({this, slot});
+        hashvals.push_back(channel->slot(slot)->hashval);
+        legal_moves.emplace_back(channel->legal(slot), channel->slot(slot)->legal_count);
+      }
+      canonicalize_fns.assign(requests.begin(), requests.end());
+      process_result_fns.assign(requests.begin(), requests.end());
+      evaluator->evaluateN(batch.size(), canonicalize_fns.data(), process_result_fns.data(), hashvals.data(),
+                           legal_moves.data());
+
+      for (int slot : batch) {
+        channel->slot(slot)->state = shm::kDone;
+        shm::wake_all(channel->slot(slot)->state);
+      }
+      total_batch_size += batch.size();
+      batch_count++;
+    }
+    header->serving = 0;
+  }
+
+  std::string statistics() {
+    std::stringstream ss;
+    ss << "Average batch size: " << total_batch_size / (double)std::max<int64_t>(1, batch_count);
+    if (reclaimed_slots) ss << ", slots reclaimed from crashed clients: " << reclaimed_slots;
+    return ss.str();
+  }
+
+ private:
+  // frees the slots claimed by processes that no longer exist. A live client only
+  // leaves a slot writing or done for the time it takes to fill or read it. Its
+  // pid is written right after the claim, so a slot is freed on the second scan
+  // finding it held by the same dead process.
+  void reclaim_slots() {
+    int count = channel->header()->slot_count;
+    dead_owners.resize(count, 0);
+    for (int i = 0; i < count; i++) {
+      auto slot = channel->slot(i);
+      uint32_t state = slot->state;
+      int32_t owner = slot->owner;
+      bool dead = (state == shm::kWriting || state == shm::kDone) && !shm::alive(owner);
+      if (dead && dead_owners[i] == owner && slot->state.compare_exchange_strong(state, shm::kFree)) {
+        reclaimed_slots++;
+        dead = false;
+      }
+      dead_owners[i] = dead ? owner : 0;
+    }
+  }
+
+  // a slot of the batch, its canonicalize copies the input of the slot and its
+  // process_result stores the result in it.
+  struct Request {
+    SharedMemoryServer* server;
+    int slot;
+
+    void operator()(float* input) const {
+      auto channel = server->channel.get();
+      std::copy(channel->input(slot), channel->input(slot) + channel->header()->input_size, input);
+    }
+
+    void operator()(const float* pi, const float* v) const { server->store(slot, pi, v); }
+  };
+
+  // only the legal entries of the policy are meaningful when legal moves are given.
+  void store(int slot, const float* pi, const float* v) {
+    auto header = channel->header();
+    std::copy(v, v + header->v_size, channel->v(slot));
+    int legal_count = channel->slot(slot)->legal_count;
+    if (legal_count == 0) {
+      std::copy(pi, pi + header->pi_size, channel->pi(slot));
+    } else {
+      const int* legal = channel->legal(slot);
+      for (int i = 0; i < legal_count; i++) {
+        channel->pi(slot)[legal[i]] = pi[legal[i]];
+      }
+    }
+  }
+
+  EvaluatorBase* evaluator;
+  std::unique_ptr<shm::Channel> channel;
+  std::vector<int32_t> dead_owners;  // per slot, found held by a dead process on the last scan
+  std::atomic<int64_t> total_batch_size = 0, batch_count = 0, reclaimed_slots = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <bit>
+#include <iomanip>
+
+#include "core/util/common.h"
+
+// log2 histogram of non-negative values, lock-free: bucket 0 counts zeros and
+// bucket i counts values in [2^(i-1), 2^i).
+class Histogram {
+ public:
+  static constexpr int kBuckets = 40;
+
+  struct Snapshot {
+    std::array<int64_t, kBuckets> counts = {};
+    int64_t count = 0, sum = 0;
+
+    double mean() const { return count ? sum / (double)count : 0; }
+
+    // largest value of the bucket holding the q-quantile.
+    int64_t percentile(double q) const {
+      int64_t seen = 0;
+      for (int i = 0; i < kBuckets; i++) {
+        seen += counts[i];
+        if (seen > 0 && seen >= q * count) return (int64_t(1) << i) - 1;
+      }
+      return 0;
+    }
+
+    void merge(const Snapshot& other) {
+      for (int i = 0; i < kBuckets; i++) counts[i] += other.counts[i];
+      count += other.count;
+      sum += other.sum;
+    }
+  };
+
+  void add(int64_t value, int64_t n = 1) {
+    int bucket = value <= 0 ? 0 : std::min(kBuckets - 1, (int)std::bit_width((uint64_t)value));
+    counts[bucket].fetch_add(n, std::memory_order_relaxed);
+    count.fetch_add(n, std::memory_order_relaxed);
+    sum.fetch_add(value * n, std::memory_order_relaxed);
+  }
+
+  Snapshot snapshot() const {
+    Snapshot snapshot;
+    for (int i = 0; i < kBuckets; i++) snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+    snapshot.count = count.load(std::memory_order_relaxed);
+    snapshot.sum = sum.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+  void reset() {
+    for (auto& bucket : counts) bucket.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::array<std::atomic<int64_t>, kBuckets> counts = {};
+  std::atomic<int64_t> count = 0, sum = 0;
+};
+
+// priority classes of requests, see EvaluatorBase::interactive().
+enum Priority : int { kBulk = 0, kInteractive, kPriorityCount };
+
+// snapshot of an evaluator's counters since their last reset. Fields an
+// evaluator does not track stay zero.
+struct EvaluatorStats {
+  double seconds = 0;  // since the last reset
+  int64_t requests = 0;
+  Histogram::Snapshot batch_size, queue_wait_us, forward_us;
+  double idle_fraction = 0;  // share of the time the evaluation thread had nothing to run
+  int64_t cache_hits = 0, cache_misses = 0;
+  int64_t coalesced = 0;  // requests answered by an identical request in flight
+  std::array<Histogram::Snapshot, kPriorityCount> latency_us;  // from submission to results, by priority
+
+  double requests_per_second() const { return seconds > 0 ? requests / seconds : 0; }
+
+  // combines the stats of evaluators running side by side.
+  void merge(const EvaluatorStats& other) {
+    seconds = std::max(seconds, other.seconds);
+    idle_fraction = (idle_fraction * batch_size.count + other.idle_fraction * other.batch_size.count) /
+                    std::max<int64_t>(1, batch_size.count + other.batch_size.count);
+    requests += other.requests;
+    batch_size.merge(other.batch_size);
+    queue_wait_us.merge(other.queue_wait_us);
+    forward_us.merge(other.forward_us);
+    cache_hits += other.cache_hits;
+    cache_misses += other.cache_misses;
+    coalesced += other.coalesced;
+    for (int i = 0; i < kPriorityCount; i++) latency_us[i].merge(other.latency_us[i]);
+  }
+
+  std::string to_string() const {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1) << "Requests: " << requests << " (" << requests_per_second() << "/s)";
+    if (batch_size.count) {
+      ss << ", batch size: mean " << batch_size.mean() << " p50 " << batch_size.percentile(0.5) << " p99 "
+         << batch_size.percentile(0.99) << ", queue wait: mean " << queue_wait_us.mean() << "us p99 "
+         << queue_wait_us.percentile(0.99) << "us, forward: mean " << forward_us.mean() << "us p99 "
+         << forward_us.percentile(0.99) << "us, idle: " << idle_fraction * 100 << "%";
+    }
+    if (coalesced) ss << ", coalesced: " << coalesced;
+    if (latency_us[kInteractive].count) {
+      ss << ", interactive: " << latency_us[kInteractive].count << " latency mean " << latency_us[kInteractive].mean()
+         << "us p99 " << latency_us[kInteractive].percentile(0.99) << "us, bulk latency mean "
+         << latency_us[kBulk].mean() << "us p99 " << latency_us[kBulk].percentile(0.99) << "us";
+    }
+    if (cache_hits + cache_misses) {
+      ss << ", cache hit rate: " << std::setprecision(3) << cache_hits / (double)(cache_hits + cache_misses) << " ("
+         << cache_hits << "/" << cache_hits + cache_misses << ")";
+    }
+    return ss.str();
+  }
+};
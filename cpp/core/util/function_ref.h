@@ -0,0 +1,29 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+// non-owning reference to a callable, like std::function without the copy and
+// the allocation: two pointers, trivially copied, one indirect call.
+// The callable must outlive the reference, e.g. a lambda passed to a function
+// taking a FunctionRef lives until the call returns.
+template <class Signature>
+class FunctionRef;
+
+template <class R, class... Args>
+class FunctionRef<R(Args...)> {
+ public:
+  template <class F>
+    requires(!std::is_same_v<std::remove_cvref_t<F>, FunctionRef> && std::is_invocable_r_v<R, F&, Args...>)
+  FunctionRef(F&& f) noexcept
+      : object(const_cast<void*>(static_cast<const void*>(std::addressof(f)))),
+        thunk([](void* object, Args... args) -> R {
+          return (*static_cast<std::remove_reference_t<F>*>(object))(std::forward<Args>(args)...);
+        }) {}
+
+  R operator()(Args... args) const { return thunk(object, std::forward<Args>(args)...); }
+
+ private:
+  void* object;
+  R (*thunk)(void*, Args...);
+};
@@ -1,6 +1,16 @@
 #pragma once
 
+#include <unistd.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 
 #pragma warning(push, 0)
 #pragma GCC diagnostic push
@@ -14,6 +24,8 @@
 #pragma GCC diagnostic pop
 #pragma warning(pop)
 
+#include "core/util/xxhash64.h"
+
 namespace torch {
 
 void print_libtorch_version() {
@@ -34,6 +46,171 @@ void print_CUDA_cuDNN_info() {
 }
 #endif
 
+/// Loads a TorchScript model in eval mode for inference, exits on failure.
+torch::jit::script::Module load_model(const std::string& model_path, torch::Device device, bool verbose) {
+  torch::jit::script::Module model;
+  try {
+    model = torch::jit::load(model_path, device);
+  } catch (const c10::Error& e) {
+    std::cerr << "Error loading the model: " << model_path << std::endl;
+    std::cerr << e.what() << std::endl;
+    exit(1);
+  }
+  if (model.is_training()) {
+    if (verbose) std::cout << "Warning: Model is in training mode. Calling eval()." << std::endl;
+    model.eval();
+  }
+  return model;
+}
+
+/// Path of the frozen artifact of a model in the model cache: the directory
+/// $SHADOWZERO_MODEL_CACHE, or ~/.cache/shadowzero/models, and a file named after
+/// a hash of the canonical path, size and modification time of the model file,
+/// the libtorch version and the device type. The model file itself is not read.
+/// Empty when the model does not exist or no cache directory is known.
+std::string model_artifact_path(const std::string& model_path, torch::Device device) {
+  std::filesystem::path dir;
+  if (auto env = std::getenv("SHADOWZERO_MODEL_CACHE")) {
+    dir = env;
+  } else if (auto home = std::getenv("HOME")) {
+    dir = std::filesystem::path(home) / ".cache" / "shadowzero" / "models";
+  }
+  std::error_code error;
+  auto path = std::filesystem::canonical(model_path, error);
+  if (dir.empty() || error) return "";
+  auto size = std::filesystem::file_size(path, error);
+  if (error) return "";
+  auto modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+  if (error) return "";
+  std::stringstream key;
+  key << path.string() << "|" << size << "|" << modified << "|" << TORCH_VERSION_MAJOR << "." << TORCH_VERSION_MINOR
+      << "." << TORCH_VERSION_PATCH << "|" << c10::DeviceTypeName(device.type(), /*lower_case=*/true) << "|frozen1";
+  std::stringstream name;
+  name << std::hex << XXHash64::hash(key.str().data(), key.str().size(), 0) << ".pt";
+  return (dir / name.str()).string();
+}
+
+/// Loads a model optimized for inference on the cpu. Freezing is the slow part,
+/// so the frozen module is kept in the model cache (see model_artifact_path())
+/// and later starts load it directly; only the optimization passes run every time.
+/// Artifacts that fail to load are rebuilt, a failure to save one only skips it.
+/// On the cpu its outputs match the ones of the module as loaded, within 1e-4
+/// (checked by core/util/libtorch_test.cpp). Models for other devices are loaded
+/// as they are: the optimized graph has not been checked on cuda.
+torch::jit::script::Module load_optimized_model(const std::string& model_path, torch::Device device, bool verbose) {
+  if (!device.is_cpu()) return load_model(model_path, device, verbose);
+  auto artifact = model_artifact_path(model_path, device);
+  torch::jit::script::Module frozen;
+  bool cached = false;
+  if (!artifact.empty() && std::filesystem::exists(artifact)) {
+    try {
+      frozen = torch::jit::load(artifact, device);
+      cached = true;
+      if (verbose) std::cout << "Loaded the frozen model from " << artifact << std::endl;
+    } catch (const c10::Error& e) {
+      std::cerr << "Ignoring the frozen model " << artifact << ": " << e.what() << std::endl;
+    }
+  }
+  if (!cached) {
+    frozen = load_model(model_path, device, verbose);
+    // models exported frozen have no training attribute and are kept as they are.
+    if (frozen.hasattr("training")) frozen = torch::jit::freeze(frozen);
+    if (!artifact.empty()) {
+      // written aside and renamed, processes starting together never read a partial file.
+      auto temporary = artifact + "." + std::to_string(getpid()) + ".tmp";
+      try {
+        std::filesystem::create_directories(std::filesystem::path(artifact).parent_path());
+        frozen.save(temporary);
+        std::filesystem::rename(temporary, artifact);
+        if (verbose) std::cout << "Saved the frozen model to " << artifact << std::endl;
+      } catch (const std::exception& e) {
+        std::cerr << "Failed to save the frozen model " << artifact << ": " << e.what() << std::endl;
+        std::error_code error;
+        std::filesystem::remove(temporary, error);
+      }
+    }
+  }
+  // undocumented API that may be useful to optimize the model
+  return torch::jit::optimize_for_inference(frozen);
+}
+
+/// Loads a model once per process: evaluators asking for the same file (at the
+/// same modification time), device and optimization share one module read-only,
+/// for as long as any of them holds it. warm_up runs once on the loaded module.
+/// Different models load concurrently. Forward calls on a shared module may run concurrently.
+/// Entries of models nobody holds anymore (swapped out, or rewritten files) are
+/// dropped on the next call.
+std::shared_ptr<torch::jit::script::Module> load_shared_model(
+    const std::string& model_path, torch::Device device, bool verbose, bool optimize,
+    const std::function<void(torch::jit::script::Module&)>& warm_up) {
+  struct Entry {
+    std::mutex mutex;
+    std::weak_ptr<torch::jit::script::Module> model;
+  };
+  static std::mutex mutex;
+  static std::map<std::string, std::shared_ptr<Entry>> entries;
+  std::error_code error;
+  auto modified = std::filesystem::last_write_time(model_path, error).time_since_epoch().count();
+  auto key = model_path + "|" + std::to_string(modified) + "|" + device.str() + "|" + (optimize ? "optimized" : "");
+
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // an entry only referenced by the map is not being loaded, and its model is
+    // gone once the weak pointer expired.
+    std::erase_if(entries, [](const auto& item) {
+      return item.second.use_count() == 1 && item.second->model.expired();
+    });
+    auto& slot = entries[key];
+    if (!slot) slot = std::make_shared<Entry>();
+    entry = slot;
+  }
+  // evaluators of a model being loaded wait for it.
+  std::lock_guard<std::mutex> lock(entry->mutex);
+  if (auto model = entry->model.lock()) {
+    if (verbose) std::cout << "Sharing the loaded model " << model_path << std::endl;
+    return model;
+  }
+  auto model = std::make_shared<torch::jit::script::Module>(
+      optimize ? load_optimized_model(model_path, device, verbose) : load_model(model_path, device, verbose));
+  warm_up(*model);
+  entry->model = model;
+  return model;
+}
+
+/// Runs the model once on a batch of ones of the given input shape, so the lazy
+/// initialization of the first forward is not paid by the first request.
+void warm_up_model(torch::jit::script::Module& module, at::IntArrayRef shape, const torch::TensorOptions& options,
+                   bool verbose) {
+  if (verbose) std::cout << "Warming up." << std::endl;
+  std::vector<torch::jit::IValue> inputs = {torch::ones(shape, options)};
+  auto outputs = module.forward(inputs).toTuple();
+  if (outputs->elements().size() > 0) {
+    if (verbose) std::cout << "Warm up ok." << std::endl;
+  }
+}
+
+/// Copies a (possibly device, possibly strided) output tensor into a reused host buffer.
+void copy_output(const torch::Tensor& output, std::vector<float>& buffer) {
+  buffer.resize(output.numel());
+  torch::from_blob(buffer.data(), output.sizes()).copy_(output);
+}
+
+/// Selects the quantized engine used by int8 models: fbgemm on x86, qnnpack on arm.
+void select_quantized_engine(bool verbose) {
+  auto& context = at::globalContext();
+  const auto& engines = context.supportedQEngines();
+  for (auto engine : {at::QEngine::FBGEMM, at::QEngine::QNNPACK}) {
+    if (std::find(engines.begin(), engines.end(), engine) != engines.end()) {
+      context.setQEngine(engine);
+      if (verbose) std::cout << "Quantized engine: " << c10::toString(engine) << std::endl;
+      return;
+    }
+  }
+  std::cerr << "No quantized engine available." << std::endl;
+  exit(1);
+}
+
 /// This is a wrapper around torch::pickle_load() that loads from a
 /// file instead of a buffer.
 /// torch::pickle_load() is used to load tensors exported by
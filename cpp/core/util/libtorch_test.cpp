@@ -0,0 +1,104 @@
+#include "core/util/libtorch.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// a small network shaped like the exported ones: conv, batch norm and relu, then
+// value and policy heads returning log-softmax outputs.
+void save_test_model(const std::string& path) {
+  torch::manual_seed(0);
+  torch::jit::Module module("TestNet");
+  module.register_attribute("training", c10::BoolType::get(), false);
+  module.register_parameter("conv_weight", torch::randn({8, 2, 3, 3}), false);
+  module.register_parameter("conv_bias", torch::randn({8}), false);
+  module.register_parameter("bn_weight", torch::randn({8}), false);
+  module.register_parameter("bn_bias", torch::randn({8}), false);
+  module.register_buffer("bn_mean", torch::randn({8}));
+  module.register_buffer("bn_var", torch::rand({8}) + 0.5);
+  module.register_parameter("v_weight", torch::randn({2, 8 * 4 * 4}), false);
+  module.register_parameter("pi_weight", torch::randn({16, 8 * 4 * 4}), false);
+  module.define(R"(
+    def forward(self, x):
+        y = torch.conv2d(x, self.conv_weight, self.conv_bias, [1, 1], [1, 1])
+        y = torch.batch_norm(y, self.bn_weight, self.bn_bias, self.bn_mean, self.bn_var, False, 0.1, 1e-5, False)
+        y = torch.relu(y).flatten(1)
+        v = torch.log_softmax(torch.linear(y, self.v_weight), 1)
+        pi = torch.log_softmax(torch.linear(y, self.pi_weight), 1)
+        return v, pi
+  )");
+  module.save(path);
+}
+
+// a model file and an empty model cache, removed at the end of the test.
+class LibtorchTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    dir = std::filesystem::temp_directory_path() / ("shadowzero-libtorch-test-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir / "cache");
+    setenv("SHADOWZERO_MODEL_CACHE", (dir / "cache").c_str(), 1);
+    model_path = (dir / "model.pt").string();
+    save_test_model(model_path);
+  }
+
+  void TearDown() override {
+    unsetenv("SHADOWZERO_MODEL_CACHE");
+    std::filesystem::remove_all(dir);
+  }
+
+  std::filesystem::path dir;
+  std::string model_path;
+};
+
+std::vector<torch::Tensor> run(torch::jit::script::Module& module, const torch::Tensor& input) {
+  torch::NoGradGuard no_grad;
+  std::vector<torch::jit::IValue> inputs = {input};
+  auto outputs = module.forward(inputs).toTuple();
+  return {outputs->elements()[0].toTensor(), outputs->elements()[1].toTensor()};
+}
+
+}  // namespace
+
+TEST_F(LibtorchTest, OptimizedModelMatchesTheModel) {
+  auto model = torch::load_model(model_path, torch::kCPU, false);
+  auto optimized = torch::load_optimized_model(model_path, torch::kCPU, false);
+  auto artifact = torch::model_artifact_path(model_path, torch::kCPU);
+  ASSERT_FALSE(artifact.empty());
+  EXPECT_TRUE(std::filesystem::exists(artifact));
+  // the second load reads the frozen artifact.
+  auto cached = torch::load_optimized_model(model_path, torch::kCPU, false);
+
+  auto input = torch::randn({64, 2, 4, 4});
+  auto expected = run(model, input);
+  for (auto* module : {&optimized, &cached}) {
+    auto outputs = run(*module, input);
+    for (int i = 0; i < 2; i++) {
+      double difference = (outputs[i] - expected[i]).abs().max().item<double>();
+      std::cout << "max difference of output " << i << ": " << difference << std::endl;
+      EXPECT_TRUE(torch::allclose(outputs[i], expected[i], /*rtol=*/1e-4, /*atol=*/1e-5));
+    }
+  }
+}
+
+TEST_F(LibtorchTest, ArtifactPathFollowsTheModelFile) {
+  auto artifact = torch::model_artifact_path(model_path, torch::kCPU);
+  ASSERT_FALSE(artifact.empty());
+  EXPECT_EQ(torch::model_artifact_path(model_path, torch::kCPU), artifact);
+  // a rewritten model gets another artifact.
+  std::filesystem::last_write_time(model_path, std::filesystem::last_write_time(model_path) + std::chrono::seconds(1));
+  EXPECT_NE(torch::model_artifact_path(model_path, torch::kCPU), artifact);
+  EXPECT_EQ(torch::model_artifact_path((dir / "missing.pt").string(), torch::kCPU), "");
+}
+
+TEST_F(LibtorchTest, SharedModelIsLoadedOnceWhileHeld) {
+  int warm_ups = 0;
+  auto warm_up = [&](torch::jit::script::Module&) { warm_ups++; };
+  auto first = torch::load_shared_model(model_path, torch::kCPU, false, /*optimize=*/false, warm_up);
+  auto second = torch::load_shared_model(model_path, torch::kCPU, false, /*optimize=*/false, warm_up);
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(warm_ups, 1);
+  // once nobody holds it, the next evaluator loads it again.
+  first.reset();
+  second.reset();
+  auto third = torch::load_shared_model(model_path, torch::kCPU, false, /*optimize=*/false, warm_up);
+  EXPECT_EQ(warm_ups, 2);
+}
@@ -0,0 +1,453 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "core/util/common.h"
+#include "core/util/softmax.h"
+
+// Native cpu inference of the NNArch network of python/nnarch.py and
+// python/nnarch_connect4.py, with weights exported by python/export_native.py.
+//
+// Boards are tiny, so the network is specialized at compile time for the
+// board shape: the activations of a position are stored channel-major with the
+// board cells padded to a multiple of 8, and every convolution reduces to one
+// kernel computing out[o][cell] = bias[o] + sum_c w[o][c] * in[c][cell] with
+// the whole (padded) board kept in registers. 3x3 convolutions go through
+// im2col first. Padding cells are never read by the layers that mix cells
+// (im2col, global pooling, heads), so their content does not matter.
+//
+// Batches are run layer by layer, so the weights of a layer stay in cache for
+// all the positions of the batch. Batch norms are folded at export time into a
+// per-channel scale and shift, or into the bias of the preceding convolution.
+//
+// Weights are not copied: the weight file is mapped read-only and the layers
+// read their tensors in place, so every network loading the same file, in this
+// process or another, shares its pages in the page cache.
+namespace native {
+
+// read-only mapping of a whole file, unmapped with its last owner.
+class MappedFile {
+ public:
+  // nullptr when the file can not be opened or mapped.
+  static std::shared_ptr<const MappedFile> open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (base == MAP_FAILED) return nullptr;
+    return std::shared_ptr<const MappedFile>(new MappedFile(base, st.st_size));
+  }
+
+  ~MappedFile() { munmap(base, bytes); }
+
+  const char* data() const { return static_cast<const char*>(base); }
+  size_t size() const { return bytes; }
+
+ private:
+  MappedFile(void* base_, size_t bytes_) : base(base_), bytes(bytes_) {}
+
+  void* base;
+  size_t bytes;
+};
+
+#if defined(__AVX2__) && defined(__FMA__)
+// mish(x) = x * tanh(softplus(x)) = x * n / (n + 2) with n = e^x * (e^x + 2)
+inline __m256 mish256_ps(__m256 x) {
+  __m256 e = exp256_ps(_mm256_min_ps(x, _mm256_set1_ps(20.0f)));
+  __m256 n = _mm256_mul_ps(e, _mm256_add_ps(e, _mm256_set1_ps(2.0f)));
+  return _mm256_mul_ps(x, _mm256_div_ps(n, _mm256_add_ps(n, _mm256_set1_ps(2.0f))));
+}
+#endif
+
+inline float mish(float x) {
+  float e = std::exp(std::min(x, 20.0f));
+  float n = e * (e + 2.0f);
+  return x * n / (n + 2.0f);
+}
+
+inline void mish_inplace(float* x, int n) {
+  int i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, mish256_ps(_mm256_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    x[i] = mish(x[i]);
+  }
+}
+
+inline void log_softmax_inplace(float* x, int n) {
+  float max = max_of(x, n);
+  float sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += std::exp(x[i] - max);
+  }
+  float shift = max + std::log(sum);
+  for (int i = 0; i < n; i++) {
+    x[i] -= shift;
+  }
+}
+
+inline float dot(const float* a, const float* b, int n) {
+  int i = 0;
+  float sum = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 vsum = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    vsum = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), vsum);
+  }
+  sum = hsum256_ps(vsum);
+#endif
+  for (; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// kRows rows of out[o][0..kCols) = bias[o] + sum_c w[o * k + c] * in[c * kCols ..], optionally followed by mish.
+template <int kCols, int kRows, bool kMish>
+inline void conv_rows(const float* w, const float* bias, int k, const float* in, float* out) {
+#if defined(__AVX2__) && defined(__FMA__)
+  constexpr int kVec = kCols / 8;
+  __m256 acc[kRows][kVec];
+  for (int r = 0; r < kRows; r++) {
+    for (int v = 0; v < kVec; v++) acc[r][v] = _mm256_set1_ps(bias ? bias[r] : 0.0f);
+  }
+  for (int c = 0; c < k; c++) {
+    __m256 x[kVec];
+    for (int v = 0; v < kVec; v++) x[v] = _mm256_loadu_ps(in + c * kCols + v * 8);
+    for (int r = 0; r < kRows; r++) {
+      __m256 wr = _mm256_set1_ps(w[r * k + c]);
+      for (int v = 0; v < kVec; v++) acc[r][v] = _mm256_fmadd_ps(wr, x[v], acc[r][v]);
+    }
+  }
+  for (int r = 0; r < kRows; r++) {
+    for (int v = 0; v < kVec; v++) {
+      _mm256_storeu_ps(out + r * kCols + v * 8, kMish ? mish256_ps(acc[r][v]) : acc[r][v]);
+    }
+  }
+#else
+  float acc[kRows][kCols];
+  for (int r = 0; r < kRows; r++) {
+    for (int i = 0; i < kCols; i++) acc[r][i] = bias ? bias[r] : 0.0f;
+  }
+  for (int c = 0; c < k; c++) {
+    const float* x = in + c * kCols;
+    for (int r = 0; r < kRows; r++) {
+      float wr = w[r * k + c];
+      for (int i = 0; i < kCols; i++) acc[r][i] += wr * x[i];
+    }
+  }
+  for (int r = 0; r < kRows; r++) {
+    for (int i = 0; i < kCols; i++) out[r * kCols + i] = kMish ? mish(acc[r][i]) : acc[r][i];
+  }
+#endif
+}
+
+// 1x1 convolution of k input channels into m output channels, on boards of kCols (padded) cells.
+template <int kCols, bool kMish>
+inline void conv1x1(const float* w, const float* bias, int m, int k, const float* in, float* out) {
+  // as many output rows at once as fit in the 16 ymm registers with the inputs.
+  constexpr int kBlock = kCols <= 16 ? 4 : (kCols <= 32 ? 2 : 1);
+  for (int o = 0; o < m; o += kBlock) {
+    if (o + kBlock <= m) {
+      conv_rows<kCols, kBlock, kMish>(w + o * k, bias ? bias + o : nullptr, k, in, out + o * kCols);
+    } else {
+      for (int r = o; r < m; r++) {
+        conv_rows<kCols, 1, kMish>(w + r * k, bias ? bias + r : nullptr, k, in, out + r * kCols);
+      }
+    }
+  }
+}
+
+template <int Channels, int Height, int Width, int Extra, int Depth, int Growth, int VSize, int PiSize>
+class NNArch {
+ public:
+  static constexpr std::array<int, 3> kShape = {Channels, Height, Width};
+  static constexpr int kInputSize = Channels * Height * Width;
+  static constexpr int kCells = Height * Width;
+  static constexpr int kPaddedCells = (kCells + 7) / 8 * 8;
+  // the extra features are stored in the last input plane.
+  static constexpr int kPlanes = Extra ? Channels - 1 : Channels;
+  static constexpr int kBottleneck = Growth * 4;
+  static constexpr int kPoolingChannels = kPlanes + Growth * (Depth / 2);
+  static constexpr int kFinalChannels = kPlanes + Growth * Depth;
+  static constexpr int kHeadChannels = 32;
+  static constexpr int kHeadSize = kHeadChannels * kCells + Extra;
+  static constexpr int kValueHidden = 256;
+  static constexpr int kVSize = VSize;
+  static constexpr int kPiSize = PiSize;
+  static_assert(Extra <= kCells, "extra features must fit in one plane");
+
+  // Loads weights exported by python/export_native.py, exits on failure.
+  // The reference outputs stored in the file are checked when verify is set.
+  void load(const std::string& path, bool verify = true, bool verbose = true) {
+    file = MappedFile::open(path);
+    if (!file) fail(path, "cannot map file");
+    Reader in{file.get(), path};
+    if (std::memcmp(in.take(4), "SZNN", 4) != 0 || in.value<uint32_t>() != 1) fail(path, "not a native weight file");
+
+    const int32_t expected[8] = {Channels, Height, Width, Extra, Depth, Growth, VSize, PiSize};
+    auto header = reinterpret_cast<const int32_t*>(in.take(sizeof(expected)));
+    if (!std::equal(header, header + 8, expected)) fail(path, "network shape mismatch");
+
+    for (int i = 0; i < Depth; i++) {
+      auto& block = blocks[i];
+      int c = kPlanes + Growth * i;
+      read(in, block.bn_scale, {c});
+      read(in, block.bn_shift, {c});
+      read(in, block.conv1_w, {kBottleneck, c});
+      read(in, block.conv1_b, {kBottleneck});
+      read(in, block.conv2_w, {Growth, kBottleneck, 3, 3});
+      if (i + 1 == Depth / 2) {
+        read(in, pool_scale, {kPoolingChannels});
+        read(in, pool_shift, {kPoolingChannels});
+        read(in, pool_fc_w, {kPoolingChannels, kPoolingChannels * 2 + Extra});
+        read(in, pool_fc_b, {kPoolingChannels});
+      }
+    }
+    read(in, v_conv_w, {kHeadChannels, kFinalChannels});
+    read(in, v_conv_b, {kHeadChannels});
+    read(in, v_fc1_w, {kValueHidden, kHeadSize});
+    read(in, v_fc1_b, {kValueHidden});
+    read(in, v_fc2_w, {VSize, kValueHidden});
+    read(in, v_fc2_b, {VSize});
+    read(in, pi_conv_w, {kHeadChannels, kFinalChannels});
+    read(in, pi_conv_b, {kHeadChannels});
+    read(in, pi_fc_w, {PiSize, kHeadSize});
+    read(in, pi_fc_b, {PiSize});
+
+    // reference inputs and TorchScript outputs, to validate this implementation.
+    auto n = in.value<int32_t>();
+    std::span<const float> input, v, pi;
+    if (n < 0) fail(path, "missing reference outputs");
+    read(in, input, {n, Channels, Height, Width});
+    read(in, v, {n, VSize});
+    read(in, pi, {n, PiSize});
+    if (verify) {
+      check_reference(path, n, input.data(), v.data(), pi.data(), verbose);
+    }
+  }
+
+  // Runs n canonical positions, v and pi receive n rows of log-softmax outputs.
+  void forward(int n, const float* input, float* v, float* pi) {
+    act.resize(n * kFinalChannels * kPaddedCells);
+    extra.resize(n * std::max(Extra, 1));
+    for (int b = 0; b < n; b++) {
+      const float* x = input + b * kInputSize;
+      float* a = activation(b);
+      for (int c = 0; c < kPlanes; c++) {
+        std::copy(x + c * kCells, x + (c + 1) * kCells, a + c * kPaddedCells);
+        std::fill(a + c * kPaddedCells + kCells, a + (c + 1) * kPaddedCells, 0.0f);
+      }
+      std::copy(x + kPlanes * kCells, x + kPlanes * kCells + Extra, extra.data() + b * std::max(Extra, 1));
+    }
+
+    for (int i = 0; i < Depth / 2; i++) dense_block(n, i);
+    global_pooling(n);
+    for (int i = Depth / 2; i < Depth; i++) dense_block(n, i);
+    heads(n, v, pi);
+  }
+
+ private:
+  struct Block {
+    std::span<const float> bn_scale, bn_shift, conv1_w, conv1_b, conv2_w;
+  };
+
+  // sequential reads from the mapped file, failing past its end.
+  struct Reader {
+    const MappedFile* file;
+    const std::string& path;
+    size_t offset = 0;
+
+    const char* take(size_t bytes) {
+      if (offset + bytes > file->size()) fail(path, "truncated file");
+      const char* p = file->data() + offset;
+      offset += bytes;
+      return p;
+    }
+
+    template <class T>
+    T value() {
+      T x;
+      std::memcpy(&x, take(sizeof(T)), sizeof(T));
+      return x;
+    }
+  };
+
+  [[noreturn]] static void fail(const std::string& path, const char* reason) {
+    std::cerr << "Error loading native weights: " << path << " (" << reason << ")" << std::endl;
+    exit(1);
+  }
+
+  // a tensor is stored as its rank, its dimensions and its float data, which is
+  // 4-byte aligned in the file and used in place.
+  static void read(Reader& in, std::span<const float>& tensor, std::initializer_list<int> shape) {
+    if (in.value<uint32_t>() != shape.size()) fail(in.path, "tensor rank mismatch");
+    size_t size = 1;
+    for (int expected : shape) {
+      if (in.value<int32_t>() != expected) fail(in.path, "tensor shape mismatch");
+      size *= expected;
+    }
+    tensor = {reinterpret_cast<const float*>(in.take(size * sizeof(float))), size};
+  }
+
+  void check_reference(const std::string& path, int n, const float* input, const float* v_ref,
+                       const float* pi_ref, bool verbose) {
+    std::vector<float> v(n * VSize), pi(n * PiSize);
+    forward(n, input, v.data(), pi.data());
+    // compared as probabilities, log-probabilities of unlikely moves are not meaningful.
+    float max_diff = 0;
+    for (int i = 0; i < n * VSize; i++) max_diff = std::max(max_diff, std::abs(std::exp(v[i]) - std::exp(v_ref[i])));
+    for (int i = 0; i < n * PiSize; i++) {
+      max_diff = std::max(max_diff, std::abs(std::exp(pi[i]) - std::exp(pi_ref[i])));
+    }
+    if (verbose) std::cout << "Native network max difference to TorchScript: " << max_diff << std::endl;
+    if (max_diff > 1e-3f) fail(path, "outputs differ from TorchScript");
+  }
+
+  float* activation(int b) { return act.data() + b * kFinalChannels * kPaddedCells; }
+
+  // out = mish(x * scale + shift) per channel.
+  static void bn_mish(const float* x, int channels, const float* scale, const float* shift, float* out) {
+    for (int c = 0; c < channels; c++) {
+      for (int i = 0; i < kPaddedCells; i++) {
+        out[c * kPaddedCells + i] = x[c * kPaddedCells + i] * scale[c] + shift[c];
+      }
+    }
+    mish_inplace(out, channels * kPaddedCells);
+  }
+
+  // rows (c, dy, dx) of the 3x3 neighbourhoods of every cell, zero outside of the board.
+  static void im2col(const float* x, float* cols) {
+    for (int c = 0; c < kBottleneck; c++) {
+      for (int dy = 0; dy < 3; dy++) {
+        for (int dx = 0; dx < 3; dx++) {
+          float* row = cols + ((c * 3 + dy) * 3 + dx) * kPaddedCells;
+          for (int y = 0; y < Height; y++) {
+            for (int x0 = 0; x0 < Width; x0++) {
+              int sy = y + dy - 1, sx = x0 + dx - 1;
+              bool inside = sy >= 0 && sy < Height && sx >= 0 && sx < Width;
+              row[y * Width + x0] = inside ? x[c * kPaddedCells + sy * Width + sx] : 0.0f;
+            }
+          }
+          std::fill(row + kCells, row + kPaddedCells, 0.0f);
+        }
+      }
+    }
+  }
+
+  // x[c..c+growth) = conv3x3(mish(bn2(conv1x1(mish(bn1(x[0..c)))))))
+  void dense_block(int n, int index) {
+    auto& block = blocks[index];
+    int c = kPlanes + Growth * index;
+    scratch.resize(kFinalChannels * kPaddedCells);
+    bottleneck.resize(kBottleneck * kPaddedCells);
+    cols.resize(kBottleneck * 9 * kPaddedCells);
+    for (int b = 0; b < n; b++) {
+      float* a = activation(b);
+      bn_mish(a, c, block.bn_scale.data(), block.bn_shift.data(), scratch.data());
+      conv1x1<kPaddedCells, true>(block.conv1_w.data(), block.conv1_b.data(), kBottleneck, c, scratch.data(),
+                                  bottleneck.data());
+      im2col(bottleneck.data(), cols.data());
+      conv1x1<kPaddedCells, false>(block.conv2_w.data(), nullptr, Growth, kBottleneck * 9, cols.data(),
+                                   a + c * kPaddedCells);
+    }
+  }
+
+  // x += fc(mean(mish(bn(x))), max(mish(bn(x))), extra), broadcast over the board.
+  void global_pooling(int n) {
+    constexpr int kFeatures = kPoolingChannels * 2 + Extra;
+    scratch.resize(kFinalChannels * kPaddedCells);
+    features.resize(n * kFeatures);
+    for (int b = 0; b < n; b++) {
+      bn_mish(activation(b), kPoolingChannels, pool_scale.data(), pool_shift.data(), scratch.data());
+      float* f = features.data() + b * kFeatures;
+      for (int c = 0; c < kPoolingChannels; c++) {
+        const float* x = scratch.data() + c * kPaddedCells;
+        float sum = 0;
+        for (int i = 0; i < kCells; i++) sum += x[i];
+        f[c] = sum / kCells;
+        f[kPoolingChannels + c] = max_of(x, kCells);
+      }
+      std::copy(extra.data() + b * std::max(Extra, 1), extra.data() + b * std::max(Extra, 1) + Extra,
+                f + kPoolingChannels * 2);
+    }
+    hidden.resize(n * kPoolingChannels);
+    linear(pool_fc_w.data(), pool_fc_b.data(), kPoolingChannels, kFeatures, n, features.data(), hidden.data());
+    for (int b = 0; b < n; b++) {
+      float* a = activation(b);
+      for (int c = 0; c < kPoolingChannels; c++) {
+        float g = hidden[b * kPoolingChannels + c];
+        for (int i = 0; i < kPaddedCells; i++) a[c * kPaddedCells + i] += g;
+      }
+    }
+  }
+
+  // flatten(mish(bn(conv1x1(x)))) followed by the extra features, for both heads.
+  void head_features(int n, std::span<const float> w, std::span<const float> bias, std::vector<float>& out) {
+    out.resize(n * kHeadSize);
+    scratch.resize(kFinalChannels * kPaddedCells);
+    for (int b = 0; b < n; b++) {
+      conv1x1<kPaddedCells, true>(w.data(), bias.data(), kHeadChannels, kFinalChannels, activation(b),
+                                  scratch.data());
+      float* f = out.data() + b * kHeadSize;
+      for (int c = 0; c < kHeadChannels; c++) {
+        std::copy(scratch.data() + c * kPaddedCells, scratch.data() + c * kPaddedCells + kCells, f + c * kCells);
+      }
+      std::copy(extra.data() + b * std::max(Extra, 1), extra.data() + b * std::max(Extra, 1) + Extra,
+                f + kHeadChannels * kCells);
+    }
+  }
+
+  void heads(int n, float* v, float* pi) {
+    head_features(n, v_conv_w, v_conv_b, features);
+    hidden.resize(n * kValueHidden);
+    linear(v_fc1_w.data(), v_fc1_b.data(), kValueHidden, kHeadSize, n, features.data(), hidden.data());
+    mish_inplace(hidden.data(), n * kValueHidden);
+    linear(v_fc2_w.data(), v_fc2_b.data(), VSize, kValueHidden, n, hidden.data(), v);
+
+    head_features(n, pi_conv_w, pi_conv_b, features);
+    linear(pi_fc_w.data(), pi_fc_b.data(), PiSize, kHeadSize, n, features.data(), pi);
+
+    for (int b = 0; b < n; b++) {
+      log_softmax_inplace(v + b * VSize, VSize);
+      log_softmax_inplace(pi + b * PiSize, PiSize);
+    }
+  }
+
+  // y[b][o] = bias[o] + w[o] . x[b], a weight row is used for the whole batch while it is in cache.
+  static void linear(const float* w, const float* bias, int m, int k, int n, const float* x, float* y) {
+    for (int o = 0; o < m; o++) {
+      for (int b = 0; b < n; b++) {
+        y[b * m + o] = bias[o] + dot(w + o * k, x + b * k, k);
+      }
+    }
+  }
+
+  // views into the mapped weight file.
+  std::shared_ptr<const MappedFile> file;
+  std::array<Block, Depth> blocks;
+  std::span<const float> pool_scale, pool_shift, pool_fc_w, pool_fc_b;
+  std::span<const float> v_conv_w, v_conv_b, v_fc1_w, v_fc1_b, v_fc2_w, v_fc2_b;
+  std::span<const float> pi_conv_w, pi_conv_b, pi_fc_w, pi_fc_b;
+
+  // workspace, reused between batches.
+  std::vector<float> act, extra, scratch, bottleneck, cols, features, hidden;
+};
+
+// the networks of python/nnarch.py and python/nnarch_connect4.py
+using ShadowNNArch = NNArch<25, 4, 4, /*Extra=*/14, /*Depth=*/8, /*Growth=*/32, /*VSize=*/2, /*PiSize=*/1024>;
+using Connect4NNArch = NNArch<5, 6, 10, /*Extra=*/0, /*Depth=*/6, /*Growth=*/32, /*VSize=*/2, /*PiSize=*/25>;
+
+}  // namespace native
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "core/util/common.h"
+
+// Binary protocol of the remote inference backend (core/evaluator/remote_client.h
+// and core/evaluator/remote_server.h), over one TCP connection per client.
+//
+// The client opens with a Hello followed by the model name, the server answers
+// with a HelloReply. Then requests and responses are frames of a FrameHeader
+// followed by `bytes` of payload, matched by id, any number of them in flight.
+// The priority of a request frame (a Priority, 0 for bulk) selects the lane of
+// the server's evaluator, responses echo it:
+//   request:  uint64 hash[count], uint16 legal_count[count], uint16 legal moves
+//             (all of them, concatenated, padded to 4 bytes), float input[count][input_size]
+//   response: for each position float v[v_size] then float pi of its legal moves
+//             only, or the whole pi[pi_size] when it has no legal moves given.
+// All values are little endian, as on every host we run on.
+namespace net {
+
+constexpr uint32_t kMagic = 0x535a5250;  // "SZRP"
+constexpr uint32_t kVersion = 1;
+
+enum HelloStatus : int32_t { kOk = 0, kUnknownModel, kShapeMismatch };
+
+struct Hello {
+  uint32_t magic, version;
+  int32_t input_size, v_size, pi_size;
+  uint32_t name_size;
+};
+
+struct HelloReply {
+  uint32_t magic, version;
+  int32_t status;
+};
+
+struct FrameHeader {
+  uint32_t id, count, bytes, priority;
+};
+
+// Limits of the server, it closes connections exceeding them: the model name
+// size and the positions per request frame (clients split larger requests).
+constexpr uint32_t kMaxNameSize = 1024;
+constexpr uint32_t kMaxFrameCount = 4096;
+
+// Size of a request payload, given its legal move counts.
+inline size_t request_bytes(size_t count, size_t legal_total, size_t input_size) {
+  size_t legal_words = (count + legal_total + 1) / 2 * 2;
+  return count * sizeof(uint64_t) + legal_words * sizeof(uint16_t) + count * input_size * sizeof(float);
+}
+
+inline bool read_all(int fd, void* buffer, size_t size) {
+  auto p = static_cast<char*>(buffer);
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+inline bool write_all(int fd, const void* buffer, size_t size) {
+  auto p = static_cast<const char*>(buffer);
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// frames are small and latency bound, so they are sent without delay.
+inline void set_nodelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Returns a connected socket, or -1.
+inline int connect_to(const std::string& host, int port) {
+  addrinfo hints = {}, *result;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) return -1;
+  int fd = -1;
+  for (auto ai = result; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd >= 0) set_nodelay(fd);
+  return fd;
+}
+
+// Returns a socket listening on address ("::" or "0.0.0.0" for all interfaces),
+// or -1. Port 0 lets the system pick a free port, see local_port().
+inline int listen_on(const std::string& address, int port) {
+  addrinfo hints = {}, *result;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) return -1;
+  int fd = -1;
+  for (auto ai = result; ai; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    int zero = 0, one = 1;
+    // "::" also accepts ipv4 clients
+    if (ai->ai_family == AF_INET6) setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 64) == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  return fd;
+}
+
+// the port a socket is bound to.
+inline int local_port(int fd) {
+  sockaddr_storage addr;
+  socklen_t size = sizeof(addr);
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &size) != 0) return -1;
+  if (addr.ss_family == AF_INET6) return ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+  return ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+}
+
+}  // namespace net
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <onnxruntime_cxx_api.h>
+
+#include "core/util/common.h"
+
+const char* inputNames[] = {"in"};
+const char* outputNames[] = {"v", "p"};
+
+namespace Ort {
+
+/// Session options shared by the onnx evaluators.
+/// The CPU execution provider is used unless built with USE_CUDA and cpu_only
+/// is false. Thread counts of 0 keep the onnxruntime defaults.
+SessionOptions evaluator_session_options(bool cpu_only, int device_id, int intra_op_threads, int inter_op_threads,
+                                         bool verbose) {
+  SessionOptions sessionOptions;
+  sessionOptions.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+  sessionOptions.SetIntraOpNumThreads(intra_op_threads);
+  sessionOptions.SetInterOpNumThreads(inter_op_threads);
+  sessionOptions.SetExecutionMode(inter_op_threads > 1 ? ORT_PARALLEL : ORT_SEQUENTIAL);
+
+#ifdef USE_CUDA
+  if (!cpu_only) {
+    if (verbose) std::cout << "Using CUDA." << std::endl;
+
+    // Legacy way to use CudaProviderOption.
+    OrtCUDAProviderOptions cudaProviderOptions;
+    cudaProviderOptions.device_id = device_id;
+    cudaProviderOptions.gpu_mem_limit = SIZE_MAX;
+    sessionOptions.AppendExecutionProvider_CUDA(cudaProviderOptions);
+
+    // Use CudaProviderOptionsV2 to enable cuda graph in cuda provider option.
+    // OrtCUDAProviderOptionsV2* cuda_options = nullptr;
+    // api.CreateCUDAProviderOptions(&cuda_options);
+    // std::unique_ptr<OrtCUDAProviderOptionsV2, decltype(api.ReleaseCUDAProviderOptions)> rel_cuda_options(cuda_options, api.ReleaseCUDAProviderOptions);
+    // std::vector<const char*> keys{ "cudnn_conv_algo_search" }; // "enable_cuda_graph"};
+    // std::vector<const char*> values{ "HEURISTIC" }; // "1"};
+    // api.UpdateCUDAProviderOptions(rel_cuda_options.get(), keys.data(), values.data(), 1);
+    // api.SessionOptionsAppendExecutionProvider_CUDA_V2(static_cast<OrtSessionOptions*>(sessionOptions), rel_cuda_options.get());
+    return sessionOptions;
+  }
+#endif
+  if (verbose) std::cout << "Using CPU." << std::endl;
+  return sessionOptions;
+}
+
+/// Runs a batch of n inputs through io binding, reading from and writing to
+/// caller owned buffers, so no tensor memory is allocated per run.
+void run_bound(Session& session, IoBinding& binding, const MemoryInfo& memory_info, float* input,
+               const int64_t d[4], float* v, int64_t v_size, float* pi, int64_t pi_size, int64_t n) {
+  int64_t input_shape[4] = {n, d[1], d[2], d[3]};
+  int64_t v_shape[2] = {n, v_size};
+  int64_t pi_shape[2] = {n, pi_size};
+  auto inputTensor = Value::CreateTensor<float>(memory_info, input, n * d[1] * d[2] * d[3], input_shape, 4);
+  auto vTensor = Value::CreateTensor<float>(memory_info, v, n * v_size, v_shape, 2);
+  auto piTensor = Value::CreateTensor<float>(memory_info, pi, n * pi_size, pi_shape, 2);
+
+  binding.BindInput(inputNames[0], inputTensor);
+  binding.BindOutput(outputNames[0], vTensor);
+  binding.BindOutput(outputNames[1], piTensor);
+  session.Run(RunOptions{nullptr}, binding);
+  binding.ClearBoundInputs();
+  binding.ClearBoundOutputs();
+}
+
+}  // namespace Ort
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <ctime>
+
+#include "core/util/common.h"
+#include "core/util/xxhash64.h"
+
+// Shared-memory request channel between local processes and the inference server
+// (cmd/serve_shadow.cpp), one channel per model.
+//
+// The channel is a fixed array of request slots. A client claims a free slot,
+// writes the canonical input and legal moves of its position, marks it ready
+// and sleeps on the slot state. The server takes every ready slot at once as
+// one batch, writes the outputs and wakes the clients up. Processes sleep on
+// futexes placed in the shared memory, so nobody spins.
+// Slots record the process that claimed them: the slots a crashed client left
+// claimed (writing or done) are freed by the server, see
+// SharedMemoryServer::reclaim_slots(). The header records the server process,
+// clients waiting on a server that crashed give up, see SharedMemoryEvaluator.
+//
+// Linux only (POSIX shared memory and shared futexes).
+namespace shm {
+
+constexpr uint32_t kMagic = 0x535a4348;  // "SZCH"
+constexpr uint32_t kVersion = 3;
+
+enum SlotState : uint32_t { kFree = 0, kWriting, kReady, kServing, kDone };
+
+struct ChannelHeader {
+  uint32_t magic, version;
+  int32_t input_size, v_size, pi_size, slot_count;
+  uint64_t slot_bytes;
+  // bumped by clients on every submission, the server sleeps on it.
+  std::atomic<uint32_t> pending;
+  // set while the server serves the channel, left set when it crashes.
+  std::atomic<uint32_t> serving;
+  int32_t server_pid;
+};
+
+struct alignas(64) SlotHeader {
+  std::atomic<uint32_t> state;
+  int32_t legal_count;
+  uint64_t hashval;
+  int32_t owner;  // pid of the client that claimed the slot
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+inline long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout = nullptr) {
+  // not FUTEX_PRIVATE_FLAG, the word is shared between processes.
+  return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+}
+
+// sleeps while *word == expected, at most timeout_ms. Returns false when it timed out.
+inline bool wait(std::atomic<uint32_t>& word, uint32_t expected, int timeout_ms) {
+  timespec timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+  return futex(&word, FUTEX_WAIT, expected, &timeout) == 0 || errno != ETIMEDOUT;
+}
+
+// whether process pid still exists.
+inline bool alive(int32_t pid) { return kill(pid, 0) == 0 || errno != ESRCH; }
+
+inline void wake_all(std::atomic<uint32_t>& word) { futex(&word, FUTEX_WAKE, INT_MAX); }
+
+// shared memory name of the channel of a model, derived from its canonical path.
+inline std::string channel_name(const std::string& model_path) {
+  auto path = std::filesystem::weakly_canonical(model_path).string();
+  std::stringstream ss;
+  ss << "/shadowzero-" << std::hex << XXHash64::hash(path.data(), path.size(), 0);
+  return ss.str();
+}
+
+class Channel {
+ public:
+  // Creates the channel of a server, replacing a stale one of the same name.
+  static std::unique_ptr<Channel> create(const std::string& name, int input_size, int v_size, int pi_size,
+                                         int slot_count) {
+    uint64_t slot_bytes = slot_size(input_size, v_size, pi_size);
+    size_t bytes = data_offset() + slot_bytes * slot_count;
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, bytes) != 0) {
+      std::cerr << "Failed to create shared memory " << name << ": " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    auto channel = std::unique_ptr<Channel>(new Channel(name, fd, bytes, /*owner=*/true));
+    auto header = channel->header();
+    new (header)
+        ChannelHeader{kMagic, kVersion, input_size, v_size, pi_size, slot_count, slot_bytes, {0}, {0}, getpid()};
+    for (int i = 0; i < slot_count; i++) {
+      new (channel->slot(i)) SlotHeader{{kFree}, 0, 0, 0};
+    }
+    return channel;
+  }
+
+  // Opens the channel of a running server, waiting for it at most timeout_ms.
+  // The channel of a server that crashed is ignored until a new server replaces it.
+  // Returns nullptr when there is none.
+  static std::unique_ptr<Channel> open(const std::string& name, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    do {
+      int fd = shm_open(name.c_str(), O_RDWR, 0600);
+      struct stat st;
+      if (fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size >= data_offset()) {
+        auto channel = std::unique_ptr<Channel>(new Channel(name, fd, st.st_size, /*owner=*/false));
+        auto header = channel->header();
+        if (header->magic == kMagic && header->version == kVersion && header->serving && alive(header->server_pid)) {
+          return channel;
+        }
+      } else if (fd >= 0) {
+        close(fd);
+      }
+      std::this_thread::sleep_for(100ms);
+    } while (std::chrono::steady_clock::now() < deadline);
+    return nullptr;
+  }
+
+  ~Channel() {
+    munmap(base, bytes);
+    if (owner) shm_unlink(name.c_str());
+  }
+
+  ChannelHeader* header() { return reinterpret_cast<ChannelHeader*>(base); }
+  SlotHeader* slot(int i) {
+    return reinterpret_cast<SlotHeader*>(static_cast<char*>(base) + data_offset() + header()->slot_bytes * i);
+  }
+  float* input(int i) { return reinterpret_cast<float*>(slot(i) + 1); }
+  float* v(int i) { return input(i) + header()->input_size; }
+  float* pi(int i) { return v(i) + header()->v_size; }
+  int* legal(int i) { return reinterpret_cast<int*>(pi(i) + header()->pi_size); }
+
+ private:
+  Channel(const std::string& name_, int fd, size_t bytes_, bool owner_) : name(name_), bytes(bytes_), owner(owner_) {
+    base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      std::cerr << "Failed to map shared memory " << name << ": " << strerror(errno) << std::endl;
+      exit(1);
+    }
+  }
+
+  static constexpr size_t data_offset() { return (sizeof(ChannelHeader) + 63) / 64 * 64; }
+  // slot header, input, v, pi and legal moves, padded to a cache line.
+  static uint64_t slot_size(int input_size, int v_size, int pi_size) {
+    uint64_t size = sizeof(SlotHeader) + sizeof(float) * (input_size + v_size + pi_size) + sizeof(int) * pi_size;
+    return (size + 63) / 64 * 64;
+  }
+
+  std::string name;
+  void* base;
+  size_t bytes;
+  bool owner;
+};
+
+}  // namespace shm
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <span>
+#include <vector>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+// Output post-processing of the evaluators.
+// The network outputs log-softmax values, we only need the exponent of the
+// legal entries, renormalized over the legal entries.
+
+#if defined(__AVX2__) && defined(__FMA__)
+// exp of 8 floats, cephes polynomial (as in avx_mathfun), input is clamped to [-88.38, 88.38].
+inline __m256 exp256_ps(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+  x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+  // express exp(x) as exp(g + n * log(2))
+  __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f));
+  fx = _mm256_floor_ps(fx);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+  __m256 z = _mm256_mul_ps(x, x);
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, z, x);
+  y = _mm256_add_ps(y, one);
+
+  // build 2^n
+  __m256i n = _mm256_cvttps_epi32(fx);
+  n = _mm256_add_epi32(n, _mm256_set1_epi32(0x7f));
+  n = _mm256_slli_epi32(n, 23);
+  return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+inline float hmax256_ps(__m256 x) {
+  __m128 m = _mm_max_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+  m = _mm_max_ss(m, _mm_movehdup_ps(m));
+  return _mm_cvtss_f32(m);
+}
+
+inline float hsum256_ps(__m256 x) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+#endif
+
+// x[i] = exp(x[i])
+inline void exp_inplace(float* x, int n) {
+  int i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(x + i, exp256_ps(_mm256_loadu_ps(x + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    x[i] = std::exp(x[i]);
+  }
+}
+
+// x[i] = exp(x[i] - shift), returns the sum of the results.
+inline float exp_shifted_sum(float* x, int n, float shift) {
+  int i = 0;
+  float sum = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  __m256 vsum = _mm256_setzero_ps();
+  __m256 vshift = _mm256_set1_ps(shift);
+  for (; i + 8 <= n; i += 8) {
+    __m256 e = exp256_ps(_mm256_sub_ps(_mm256_loadu_ps(x + i), vshift));
+    _mm256_storeu_ps(x + i, e);
+    vsum = _mm256_add_ps(vsum, e);
+  }
+  sum = hsum256_ps(vsum);
+#endif
+  for (; i < n; i++) {
+    x[i] = std::exp(x[i] - shift);
+    sum += x[i];
+  }
+  return sum;
+}
+
+inline float max_of(const float* x, int n) {
+  int i = 0;
+  float result = std::numeric_limits<float>::lowest();
+#if defined(__AVX2__) && defined(__FMA__)
+  if (n >= 8) {
+    __m256 vmax = _mm256_loadu_ps(x);
+    for (i = 8; i + 8 <= n; i += 8) {
+      vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + i));
+    }
+    result = hmax256_ps(vmax);
+  }
+#endif
+  for (; i < n; i++) {
+    result = std::max(result, x[i]);
+  }
+  return result;
+}
+
+// Softmax of a contiguous log-softmax segment, in place.
+inline void softmax_inplace(float* x, int n) {
+  float scale = 1.0f / exp_shifted_sum(x, n, max_of(x, n));
+  for (int i = 0; i < n; i++) {
+    x[i] *= scale;
+  }
+}
+
+// Softmax of a log-softmax row restricted to the legal entries.
+// Only row[legal[i]] are written, they are non-negative and sum up to 1.
+// Other entries of the row are left as they are.
+inline void masked_softmax(float* row, std::span<const int> legal) {
+  int n = legal.size();
+  thread_local std::vector<float> buffer;
+  buffer.resize(n);
+  float* x = buffer.data();
+
+  int i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+  for (; i + 8 <= n; i += 8) {
+    __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(legal.data() + i));
+    _mm256_storeu_ps(x + i, _mm256_i32gather_ps(row, index, sizeof(float)));
+  }
+#endif
+  for (; i < n; i++) {
+    x[i] = row[legal[i]];
+  }
+
+  softmax_inplace(x, n);
+  for (i = 0; i < n; i++) {
+    row[legal[i]] = x[i];
+  }
+}
+
+// Post-processes one output row of an evaluator: the value row is exponentiated,
+// the policy row is masked_softmax-ed when legal moves are given, otherwise
+// exponentiated as a whole.
+inline void postprocess_output(float* v, int v_size, float* pi, int pi_size, std::span<const int> legal) {
+  exp_inplace(v, v_size);
+  if (legal.empty()) {
+    exp_inplace(pi, pi_size);
+  } else {
+    masked_softmax(pi, legal);
+  }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "core/util/common.h"
+#include "core/util/xxhash64.h"
 
 // this is an implementation of N,M,k game
 namespace Connect4 {
@@ -48,15 +49,37 @@ class GameState {
     return std::make_unique<GameState>(*this);
   }
 
-  uint64_t Hash() const noexcept {
-    // not implemented
-    return 0;
+  uint64_t Hash() const noexcept { return Symmetry_hash(0); }
+
+  // hash of the position transformed by the given symmetry, symmetry 1
+  // transposes the board as create_symmetry_board does.
+  uint64_t Symmetry_hash(int symmetry) const noexcept {
+    struct {
+      int8_t piece[N][N][N][2];
+      int8_t current_player;
+    } key;
+    for (int i = 0; i < N; i++) {
+      for (int j = 0; j < N; j++) {
+        for (int k = 0; k < N; k++) {
+          key.piece[i][j][k][0] = symmetry ? piece[i][k][j][0] : piece[i][j][k][0];
+          key.piece[i][j][k][1] = symmetry ? piece[i][k][j][1] : piece[i][j][k][1];
+        }
+      }
+    }
+    key.current_player = current_player;
+    return XXHash64::hash(&key, sizeof(key), 0);
   }
 
+  // the symmetry with the smallest hash, a position and its mirror always pick
+  // the same representative.
+  int Canonical_symmetry() const noexcept { return Symmetry_hash(1) < Symmetry_hash(0) ? 1 : 0; }
+
   bool Current_player() const noexcept { return current_player; }
 
   int Num_actions() const noexcept { return NUM_ACTIONS; }
 
+  int Canonical_size() const noexcept { return CANONICAL_SHAPE[0] * CANONICAL_SHAPE[1] * CANONICAL_SHAPE[2]; }
+
   std::vector<uint8_t> Valid_moves() const {
     auto valids = std::vector<uint8_t>(NUM_ACTIONS, 0);
     for (int i = 0; i < N; i++) {
@@ -217,13 +240,14 @@ class GameState {
     assert(CANONICAL_SHAPE[0] == N && CANONICAL_SHAPE[1] == N + 1 &&
            CANONICAL_SHAPE[2] == N * 2);
     
-    for (int i = 0; i < N; i++) {
-      for (int j = 0; j < N; j++) {
-        dst[i * N + j] = src[j * N + i];
-      }
+    for (int idx = 0; idx < NUM_ACTIONS; idx++) {
+      dst[symmetry_action(idx)] = src[idx];
     }
   }
 
+  // the action of the transposed position, see create_symmetry_action
+  ActionType symmetry_action(ActionType action) const noexcept { return action % N * N + action / N; }
+
   void create_symmetry_boards(float* dst, const float* src) const {
     create_symmetry_board(dst, src);
   }
@@ -0,0 +1,51 @@
+#include "game/connect4.h"
+
+#include "gtest/gtest.h"
+
+using namespace Connect4;
+
+TEST(GameConnect4, TestSymmetryHash) {
+  GameState game;
+  game.Move(game.string_to_action("a2"));
+  game.Move(game.string_to_action("d1"));
+  game.Move(game.string_to_action("a2"));
+
+  // the same moves on the transposed board.
+  GameState game2;
+  game2.Move(game2.symmetry_action(game2.string_to_action("a2")));
+  game2.Move(game2.symmetry_action(game2.string_to_action("d1")));
+  game2.Move(game2.symmetry_action(game2.string_to_action("a2")));
+
+  EXPECT_NE(game.Hash(), game2.Hash());
+  EXPECT_EQ(game.Symmetry_hash(1), game2.Hash());
+  EXPECT_EQ(game2.Symmetry_hash(1), game.Hash());
+  EXPECT_NE(game.Canonical_symmetry(), game2.Canonical_symmetry());
+
+  // the initial position (c3, b2) is its own transpose.
+  GameState initial;
+  EXPECT_EQ(initial.Symmetry_hash(1), initial.Hash());
+  EXPECT_EQ(initial.Canonical_symmetry(), 0);
+}
+
+TEST(GameConnect4, TestSymmetryBoard) {
+  GameState game;
+  game.Move(game.string_to_action("e1"));
+  game.Move(game.string_to_action("c3"));
+
+  GameState game2;
+  game2.Move(game2.symmetry_action(game2.string_to_action("e1")));
+  game2.Move(game2.symmetry_action(game2.string_to_action("c3")));
+
+  // the transposed input of a position is the input of its transposed position.
+  std::vector<float> board(game.Canonical_size()), board2(game.Canonical_size()), symmetry(game.Canonical_size());
+  game.Canonicalize(board.data());
+  game2.Canonicalize(board2.data());
+  game.create_symmetry_board(symmetry.data(), board.data());
+  EXPECT_EQ(symmetry, board2);
+
+  // and the transposed policy puts each action on its transposed action.
+  std::vector<float> pi(NUM_ACTIONS), pi2(NUM_ACTIONS);
+  for (int i = 0; i < NUM_ACTIONS; i++) pi[i] = i;
+  game.create_symmetry_action(pi2.data(), pi.data());
+  for (int i = 0; i < NUM_ACTIONS; i++) EXPECT_EQ(pi2[game.symmetry_action(i)], i);
+}
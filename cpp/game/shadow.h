@@ -1,6 +1,7 @@
 #pragma once
 
 #include "core/util/common.h"
+#include "core/util/xxhash64.h"
 
 namespace Shadow {
 
@@ -15,10 +16,10 @@ using ActionType = int;
 
 const ActionType MOVE_PASS = -1;
 
-const int8_t dirx[16] = {0, 1, 0, -1, 1, 1, -1, -1, 0, 2, 0, -2, 2, 2, -2, -2};
-const int8_t diry[16] = {1, 0, -1, 0, 1, -1, 1, -1, 2, 0, -2, 0, 2, -2, 2, -2};
-const int8_t first_step_x[16] = {0, 1, 0, -1, 1, 1, -1, -1, 0, 1, 0, -1, 1, 1, -1, -1};
-const int8_t first_step_y[16] = {1, 0, -1, 0, 1, -1, 1, -1, 1, 0, -1, 0, 1, -1, 1, -1};
+constexpr int8_t dirx[16] = {0, 1, 0, -1, 1, 1, -1, -1, 0, 2, 0, -2, 2, 2, -2, -2};
+constexpr int8_t diry[16] = {1, 0, -1, 0, 1, -1, 1, -1, 2, 0, -2, 0, 2, -2, 2, -2};
+constexpr int8_t first_step_x[16] = {0, 1, 0, -1, 1, 1, -1, -1, 0, 1, 0, -1, 1, 1, -1, -1};
+constexpr int8_t first_step_y[16] = {1, 0, -1, 0, 1, -1, 1, -1, 1, 0, -1, 0, 1, -1, 1, -1};
 const char* pos_a_name = {"12345678"};
 const char* pos_b_name[2][2] = {{"5678efgh", "1234abcd"}, {"abcdefgh", "abcdefgh"}};
 const int8_t pos_b_index[2][2][8] = {
@@ -35,6 +36,51 @@ const char* dir_name_alt[2][16] = {
 // the position of the piece is 0 ~ 15, so 16 means it was captured.
 const int CAPTURED = 16;
 
+// Boards are bitboards: bit x + 4 * y is set when a piece is on that square, as
+// seen by the player owning the pieces. The opponent sees board k as its board
+// 3 - k with every square s at 15 - s, that is with the bits reversed.
+constexpr uint16_t mirror(uint16_t board) {
+  board = (board & 0x5555) << 1 | (board >> 1 & 0x5555);
+  board = (board & 0x3333) << 2 | (board >> 2 & 0x3333);
+  board = (board & 0x0f0f) << 4 | (board >> 4 & 0x0f0f);
+  return board << 8 | board >> 8;
+}
+
+// per square and direction, as a bit (0 off the board): where a piece moves to,
+// the first square on its way (the destination itself for single steps), and
+// where a piece it pushes lands, one step beyond the destination.
+struct StepTables {
+  uint16_t destination[16][16], way[16][16], beyond[16][16];
+};
+
+constexpr StepTables make_step_tables() {
+  StepTables tables = {};
+  auto bit = [](int x, int y) { return x >= 0 && x < 4 && y >= 0 && y < 4 ? uint16_t(1 << (x + y * 4)) : uint16_t(0); };
+  for (int square = 0; square < 16; square++) {
+    int x = square % 4, y = square / 4;
+    for (int dir = 0; dir < 16; dir++) {
+      tables.destination[square][dir] = bit(x + dirx[dir], y + diry[dir]);
+      tables.way[square][dir] = bit(x + first_step_x[dir], y + first_step_y[dir]);
+      tables.beyond[square][dir] = bit(x + dirx[dir] + first_step_x[dir], y + diry[dir] + first_step_y[dir]);
+    }
+  }
+  return tables;
+}
+
+constexpr StepTables step_tables = make_step_tables();
+
+// square of the piece with the given index on a board, pieces are indexed by square.
+inline int nth_square(uint16_t board, int index) {
+  for (int i = 0; i < index; i++) board &= board - 1;
+  return std::countr_zero(board);
+}
+
+// the piece list of a board: squares in ascending order, then CAPTURED.
+inline void board_pieces(uint16_t board, int8_t* pieces) {
+  std::memset(pieces, CAPTURED, 4);
+  for (; board; board &= board - 1) *pieces++ = std::countr_zero(board);
+}
+
 void sort4(int8_t* arr) {
   if (arr[0] > arr[1]) std::swap(arr[0], arr[1]);
   if (arr[2] > arr[3]) std::swap(arr[2], arr[3]);
@@ -48,22 +94,32 @@ class GameState {
   bool current_player;
   bool __unused;
   int16_t round;
-  int8_t piece[2][16];  // player_id, piece_id. piece 0~7 is moveable, piece
-                        // 8~15 is shadow.
+  uint16_t board[2][4];  // player_id, board_id. Pieces on boards 0~1 are moveable,
+                         // on boards 2~3 shadow. Piece i of a board is its i-th
+                         // lowest square.
 
  public:
   GameState() {
     current_player = 0;
     round = 0;
     for (int j = 0; j < 2; j++) {
-      for (int i = 0; i < 16; i++) {
-        piece[j][i] = i % 4;
+      for (int i = 0; i < 4; i++) {
+        board[j][i] = 0x000f;
       }
     }
   }
 
+  // from piece lists: player_id, piece_id, piece 0~7 is moveable, piece 8~15 is
+  // shadow, each group of 4 sorted.
   GameState(bool current_player, int16_t round, int8_t piece[2][16]) : current_player(current_player), round(round) {
-    std::memcpy(this->piece, piece, sizeof(this->piece));
+    for (int j = 0; j < 2; j++) {
+      for (int i = 0; i < 4; i++) {
+        board[j][i] = 0;
+      }
+      for (int i = 0; i < 16; i++) {
+        if (piece[j][i] != CAPTURED) board[j][i / 4] |= 1 << piece[j][i];
+      }
+    }
   }
 
   std::string action_to_string(const ActionType action) {
@@ -95,95 +151,83 @@ class GameState {
 
   std::unique_ptr<GameState> Copy() const { return std::make_unique<GameState>(*this); }
 
-  uint64_t Hash() const noexcept {
-    // not implemented
-    return 0;
+  uint64_t Hash() const noexcept { return Symmetry_hash(0); }
+
+  // hash of the position transformed by the given symmetry, symmetry 1 swaps
+  // boards (a,b,c,d -> b,a,d,c) as create_symmetry_board does.
+  // everything Canonicalize reads is hashed, so equal hashes share one evaluation.
+  uint64_t Symmetry_hash(int symmetry) const noexcept {
+    struct {
+      int8_t piece[2][16];
+      int8_t current_player;
+      int8_t round;
+    } key;
+    for (int p = 0; p < 2; p++) {
+      for (int i = 0; i < 4; i++) {
+        board_pieces(board[p][symmetry ? i ^ 1 : i], key.piece[p] + i * 4);
+      }
+    }
+    key.current_player = current_player;
+    key.round = round % 24;
+    return XXHash64::hash(&key, sizeof(key), 0);
   }
 
+  // the symmetry with the smallest hash, a position and its mirror always pick
+  // the same representative.
+  int Canonical_symmetry() const noexcept { return Symmetry_hash(1) < Symmetry_hash(0) ? 1 : 0; }
+
   bool Current_player() const noexcept { return current_player; }
 
   int Num_actions() const noexcept { return NUM_ACTIONS; }
 
+  int Canonical_size() const noexcept { return CANONICAL_SHAPE[0] * CANONICAL_SHAPE[1] * CANONICAL_SHAPE[2]; }
+
   std::vector<uint8_t> Valid_moves() const {
     auto valids = std::vector<uint8_t>(NUM_ACTIONS, 0);
-    bool vshadow = (round / 12) % 2 == 0;
-
-    uint8_t board[2][4][4][4] = {0};
-    int8_t position[2][16];
-
-    for (int i = 0; i < 16; i++) {
-      position[0][i] = piece[current_player][i];
-      position[1][i] = piece[!current_player][i] == CAPTURED ? CAPTURED : 15 - piece[!current_player][i];
-    }
-
-    for (int p = 0; p < 2; p++) {
-      for (int i = 0; i < 16; i++) {
-        if (position[p][i] != CAPTURED) board[p][p ? 3 - i / 4 : i / 4][position[p][i] % 4][position[p][i] / 4] = 1;
-      }
+    int shadow = (round / 12) % 2;
+
+    // the boards as seen by the current player.
+    uint16_t own[4], opponent[4], occupied[4];
+    for (int k = 0; k < 4; k++) {
+      own[k] = board[current_player][k];
+      opponent[k] = mirror(board[!current_player][3 - k]);
+      occupied[k] = own[k] | opponent[k];
     }
 
     for (int dir = 0; dir < 16; dir++) {
-      auto dx = dirx[dir], dy = diry[dir];
-      for (int a = 0; a < 8; a++) {
-        for (int b = 0; b < 8; b++) {
-          int board_a = a / 4;
-          int board_b = vshadow ? a < 4 ? (b < 4 ? 1 : 3) : (b < 4 ? 0 : 2) : b / 4 + 2;
-
-          auto position_a = position[0][a];
-          auto position_b = position[0][board_b * 4 + b % 4];
-
-          // if captured, it can't move
-          if (position_a == CAPTURED || position_b == CAPTURED) {
-            continue;
+      // by piece id: pieces that can move as a (leaving the board among them), and as b (pushing among them).
+      uint16_t a_moves = 0, a_out = 0, b_moves = 0, b_push = 0;
+      for (int k = 0; k < 4; k++) {
+        int i = k * 4;
+        for (uint16_t pieces = own[k]; pieces; pieces &= pieces - 1, i++) {
+          int square = std::countr_zero(pieces);
+          uint16_t destination = step_tables.destination[square][dir], way = step_tables.way[square][dir] | destination;
+
+          // a needs a free way, it may leave the board.
+          if (k < 2 && !(way & occupied[k])) {
+            a_moves |= 1 << i;
+            if (!destination) a_out |= 1 << i;
           }
 
-          auto ax = position_a % 4;
-          auto ay = position_a / 4;
-          auto bx = position_b % 4;
-          auto by = position_b / 4;
-
-          // if b move out of board, it can't move
-          if (bx + dx < 0 || bx + dx >= 4 || by + dy < 0 || by + dy >= 4) {
-            continue;
-          }
-
-          bool move_out_flag = false;
-
-          // if anything in a's way, it can't move
-          if (ax + first_step_x[dir] < 0 || ax + first_step_x[dir] >= 4 || ay + first_step_y[dir] < 0 ||
-              ay + first_step_y[dir] >= 4) {
-          } else if (board[0][board_a][ax + first_step_x[dir]][ay + first_step_y[dir]] ||
-                     board[1][board_a][ax + first_step_x[dir]][ay + first_step_y[dir]]) {
-            continue;
-          }
-          if (ax + dx < 0 || ax + dx >= 4 || ay + dy < 0 || ay + dy >= 4) {
-            move_out_flag = true;
-          } else if (board[0][board_a][ax + dx][ay + dy] || board[1][board_a][ax + dx][ay + dy]) {
-            continue;
-          }
-
-          // if friendly piece in b's way, it can't move
-          if (board[0][board_b][bx + first_step_x[dir]][by + first_step_y[dir]] ||
-              board[0][board_b][bx + dx][by + dy]) {
-            continue;
-          }
-
-          // if two opponent pieces in b's way, it can't move
-          int count = board[1][board_b][bx + dx][by + dy];
-          if (dir >= 8 && board[1][board_b][bx + first_step_x[dir]][by + first_step_y[dir]]) count++;
-          if (count == 0 && move_out_flag) {
-            continue;
-          }
-
-          if (int cx = bx + dx + first_step_x[dir], cy = by + dy + first_step_y[dir];
-              cx >= 0 && cx < 4 && cy >= 0 && cy < 4 && (board[0][board_b][cx][cy] || board[1][board_b][cx][cy])) {
-            count++;
-          }
-          if (count >= 2) {
-            continue;
+          // b stays on the board, with no friendly piece in its way, and pushes at most one opponent piece, onto an
+          // empty square or off the board.
+          if (destination && !(way & own[k])) {
+            int pushed = std::popcount(uint16_t(way & opponent[k]));
+            if (pushed + ((step_tables.beyond[square][dir] & occupied[k]) != 0) < 2) {
+              b_moves |= 1 << i;
+              if (pushed) b_push |= 1 << i;
+            }
           }
+        }
+      }
 
-          valids[dir * 64 + a * 8 + b] = 1;
+      // a may only leave the board if b pushes.
+      for (uint16_t pieces = a_moves; pieces; pieces &= pieces - 1) {
+        int a = std::countr_zero(pieces);
+        uint16_t partners = a_out >> a & 1 ? b_push : b_moves;
+        const int8_t* b_index = pos_b_index[shadow][a >= 4];
+        for (int b = 0; b < 8; b++) {
+          if (partners >> b_index[b] & 1) valids[dir * 64 + a * 8 + b] = 1;
         }
       }
     }
@@ -204,56 +248,32 @@ class GameState {
     assert(b >= 0 && b < 16);
     assert(dir >= 0 && dir < 16);
 
-    auto& piece_a = piece[current_player][a];
-    assert(piece_a >= 0 && piece_a < 16);
-    auto ax = piece_a % 4;
-    auto ay = piece_a / 4;
-    if (ax + dirx[dir] < 0 || ax + dirx[dir] >= 4 || ay + diry[dir] < 0 || ay + diry[dir] >= 4) {
-      piece_a = CAPTURED;
-    } else {
-      piece_a = (ax + dirx[dir]) + (ay + diry[dir]) * 4;
-      assert(piece_a >= 0 && piece_a < 16);
+    // a and b are on different boards, a piece moving off the board is captured.
+    auto& board_a = board[current_player][a / 4];
+    assert(a % 4 < std::popcount(board_a));
+    int square_a = nth_square(board_a, a % 4);
+    board_a = (board_a & ~(1 << square_a)) | step_tables.destination[square_a][dir];
+
+    auto& board_b = board[current_player][b / 4];
+    assert(b % 4 < std::popcount(board_b));
+    int square_b = nth_square(board_b, b % 4);
+    board_b = (board_b & ~(1 << square_b)) | step_tables.destination[square_b][dir];
+
+    // the opponent piece in b's way (the first one by piece id) is pushed beyond b's destination.
+    auto& board_op = board[!current_player][3 - b / 4];
+    uint16_t way = step_tables.way[square_b][dir] | step_tables.destination[square_b][dir];
+    if (uint16_t pushed = board_op & mirror(way)) {
+      board_op = (board_op & ~(1 << std::countr_zero(pushed))) | mirror(step_tables.beyond[square_b][dir]);
     }
 
-    auto& piece_b = piece[current_player][b];
-    assert(piece_b >= 0 && piece_b < 16);
-    auto bx = piece_b % 4;
-    auto by = piece_b / 4;
-    if (bx + dirx[dir] < 0 || bx + dirx[dir] >= 4 || by + diry[dir] < 0 || by + diry[dir] >= 4) {
-      piece_b = CAPTURED;
-    } else {
-      piece_b = (bx + dirx[dir]) + (by + diry[dir]) * 4;
-      assert(piece_b >= 0 && piece_b < 16);
-    }
-
-    int op = (3 - b / 4) * 4;
-    for (int i = op; i < op + 4; i++) {
-      if (15 - piece[!current_player][i] == piece_b ||
-          15 - piece[!current_player][i] == (bx + first_step_x[dir]) + (by + first_step_y[dir]) * 4) {
-        auto cx = bx + first_step_x[dir] + dirx[dir];
-        auto cy = by + first_step_y[dir] + diry[dir];
-        if (cx >= 0 && cx < 4 && cy >= 0 && cy < 4) {
-          piece[!current_player][i] = 15 - cx - cy * 4;
-        } else {
-          piece[!current_player][i] = CAPTURED;
-        }
-        break;
-      }
-    }
-
-    sort4(&piece[current_player][a / 4 * 4]);
-    sort4(&piece[current_player][b / 4 * 4]);
-    sort4(&piece[!current_player][op]);
-
     current_player = !current_player;
     round += 1;
   }
 
   bool End() const {
     for (int i = 0; i < 2; i++) {
-      for (int j = 0; j < 16; j += 4) {
-        if (piece[i][j] == CAPTURED && piece[i][j + 1] == CAPTURED && piece[i][j + 2] == CAPTURED &&
-            piece[i][j + 3] == CAPTURED) {
+      for (int j = 0; j < 4; j++) {
+        if (!board[i][j]) {
           return true;
         }
       }
@@ -264,9 +284,8 @@ class GameState {
 
   bool Winner() const {
     for (int i = 0; i < 2; i++) {
-      for (int j = 0; j < 16; j += 4) {
-        if (piece[i][j] == CAPTURED && piece[i][j + 1] == CAPTURED && piece[i][j + 2] == CAPTURED &&
-            piece[i][j + 3] == CAPTURED) {
+      for (int j = 0; j < 4; j++) {
+        if (!board[i][j]) {
           return !i;
         }
       }
@@ -279,9 +298,8 @@ class GameState {
     assert(End());
 
     for (int i = 0; i < 2; i++) {
-      for (int j = 0; j < 16; j += 4) {
-        if (piece[i][j] == CAPTURED && piece[i][j + 1] == CAPTURED && piece[i][j + 2] == CAPTURED &&
-            piece[i][j + 3] == CAPTURED) {
+      for (int j = 0; j < 4; j++) {
+        if (!board[i][j]) {
           return i == 0 ? 0.0f : 1.0f;
         }
       }
@@ -298,22 +316,23 @@ class GameState {
     float(&out)[CANONICAL_SHAPE[0]][CANONICAL_SHAPE[1]][CANONICAL_SHAPE[2]] =
         *reinterpret_cast<float(*)[CANONICAL_SHAPE[0]][CANONICAL_SHAPE[1]][CANONICAL_SHAPE[2]]>(storage);
 
-    float capture_count[2] = {0.0f, 0.0f};
+    float capture_count[2] = {16.0f, 16.0f};
 
     // channel 0..15 represent each piece position of the current player
     // channel 16..19 represent current player board 0-3
     // channel 20..23 represent opponent player board 0-3
-    for (int i = 0; i < 16; i++) {
-      if (piece[current_player][i] != CAPTURED) {
-        out[i][piece[current_player][i] / 4][piece[current_player][i] % 4] = 1.0f;
-        out[16 + i / 4][piece[current_player][i] / 4][piece[current_player][i] % 4] = 1.0f;
-      } else {
-        capture_count[0] += 1.0f;
+    for (int k = 0; k < 4; k++) {
+      int i = k * 4;
+      for (uint16_t pieces = board[current_player][k]; pieces; pieces &= pieces - 1, i++) {
+        int square = std::countr_zero(pieces);
+        out[i][square / 4][square % 4] = 1.0f;
+        out[16 + k][square / 4][square % 4] = 1.0f;
+        capture_count[0] -= 1.0f;
       }
-      if (piece[!current_player][i] != CAPTURED) {
-        out[20 + i / 4][piece[!current_player][i] / 4][piece[!current_player][i] % 4] = 1.0f;
-      } else {
-        capture_count[1] += 1.0f;
+      for (uint16_t pieces = board[!current_player][k]; pieces; pieces &= pieces - 1) {
+        int square = std::countr_zero(pieces);
+        out[20 + k][square / 4][square % 4] = 1.0f;
+        capture_count[1] -= 1.0f;
       }
     }
 
@@ -336,6 +355,13 @@ class GameState {
   std::string ToString() const {
     std::string out;
 
+    int8_t piece[2][16];
+    for (int p = 0; p < 2; p++) {
+      for (int i = 0; i < 4; i++) {
+        board_pieces(this->board[p][i], piece[p] + i * 4);
+      }
+    }
+
     char board[8][8];
     std::fill(board[0], board[0] + 8 * 8, '.');
 
@@ -414,21 +440,19 @@ class GameState {
     // if we change the shape, we need to update this function
     assert(CANONICAL_SHAPE[0] == 25);
 
-    bool vshadow = (round / 12) % 2 == 0;
-
-    for (int dir = 0; dir < 16; dir++) {
-      for (int a = 0; a < 8; a++) {
-        for (int b = 0; b < 8; b++) {
-          int idx = dir * 64 + a * 8 + b;
+    for (int idx = 0; idx < NUM_ACTIONS; idx++) {
+      dst[symmetry_action(idx)] = src[idx];
+    }
+  }
 
-          int new_a = a ^ 4;
-          int new_b = vshadow ? b : b ^ 4;
-          int new_idx = dir * 64 + new_a * 8 + new_b;
+  // the action of the flipped position, see create_symmetry_action
+  ActionType symmetry_action(ActionType action) const noexcept {
+    bool vshadow = (round / 12) % 2 == 0;
 
-          dst[new_idx] = src[idx];
-        }
-      }
-    }
+    int dir = action / 64, a = action % 64 / 8, b = action % 8;
+    int new_a = a ^ 4;
+    int new_b = vshadow ? b : b ^ 4;
+    return dir * 64 + new_a * 8 + new_b;
   }
 
   void create_symmetry_boards(float* dst, const float* src) const { create_symmetry_board(dst, src); }
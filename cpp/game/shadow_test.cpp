@@ -529,3 +529,280 @@ TEST(GameShadow, TestSymmetryAction2) {
   EXPECT_EQ(symmetry[0][game2.string_to_action("3cd")], actions[game.string_to_action("7gd")]);
   EXPECT_EQ(symmetry[0][game2.string_to_action("8dr2")], actions[game.string_to_action("4hr2")]);
 }
+
+TEST(GameShadow, TestSymmetryHash) {
+  GameState game;
+  game.Move(game.string_to_action("1edr"));
+  game.Move(game.string_to_action("1eul"));
+
+  GameState game2;
+  game2.Move(game2.string_to_action("5adr"));
+  game2.Move(game2.string_to_action("5aul"));
+
+  EXPECT_NE(game.Hash(), game2.Hash());
+  EXPECT_EQ(game.Symmetry_hash(1), game2.Hash());
+  EXPECT_EQ(game2.Symmetry_hash(1), game.Hash());
+  EXPECT_NE(game.Canonical_symmetry(), game2.Canonical_symmetry());
+
+  // the initial position is its own mirror.
+  GameState initial;
+  EXPECT_EQ(initial.Symmetry_hash(1), initial.Hash());
+  EXPECT_EQ(initial.Canonical_symmetry(), 0);
+}
+
+// the piece list implementation the bitboards replaced, to check them against.
+namespace reference {
+
+struct Position {
+  bool current_player = 0;
+  int16_t round = 0;
+  int8_t piece[2][16];
+
+  std::vector<uint8_t> Valid_moves() const {
+    auto valids = std::vector<uint8_t>(NUM_ACTIONS, 0);
+    bool vshadow = (round / 12) % 2 == 0;
+
+    uint8_t board[2][4][4][4] = {0};
+    int8_t position[2][16];
+
+    for (int i = 0; i < 16; i++) {
+      position[0][i] = piece[current_player][i];
+      position[1][i] = piece[!current_player][i] == CAPTURED ? CAPTURED : 15 - piece[!current_player][i];
+    }
+
+    for (int p = 0; p < 2; p++) {
+      for (int i = 0; i < 16; i++) {
+        if (position[p][i] != CAPTURED) board[p][p ? 3 - i / 4 : i / 4][position[p][i] % 4][position[p][i] / 4] = 1;
+      }
+    }
+
+    for (int dir = 0; dir < 16; dir++) {
+      auto dx = dirx[dir], dy = diry[dir];
+      for (int a = 0; a < 8; a++) {
+        for (int b = 0; b < 8; b++) {
+          int board_a = a / 4;
+          int board_b = vshadow ? a < 4 ? (b < 4 ? 1 : 3) : (b < 4 ? 0 : 2) : b / 4 + 2;
+
+          auto position_a = position[0][a];
+          auto position_b = position[0][board_b * 4 + b % 4];
+          if (position_a == CAPTURED || position_b == CAPTURED) {
+            continue;
+          }
+
+          auto ax = position_a % 4;
+          auto ay = position_a / 4;
+          auto bx = position_b % 4;
+          auto by = position_b / 4;
+          if (bx + dx < 0 || bx + dx >= 4 || by + dy < 0 || by + dy >= 4) {
+            continue;
+          }
+
+          bool move_out_flag = false;
+          if (ax + first_step_x[dir] < 0 || ax + first_step_x[dir] >= 4 || ay + first_step_y[dir] < 0 ||
+              ay + first_step_y[dir] >= 4) {
+          } else if (board[0][board_a][ax + first_step_x[dir]][ay + first_step_y[dir]] ||
+                     board[1][board_a][ax + first_step_x[dir]][ay + first_step_y[dir]]) {
+            continue;
+          }
+          if (ax + dx < 0 || ax + dx >= 4 || ay + dy < 0 || ay + dy >= 4) {
+            move_out_flag = true;
+          } else if (board[0][board_a][ax + dx][ay + dy] || board[1][board_a][ax + dx][ay + dy]) {
+            continue;
+          }
+
+          if (board[0][board_b][bx + first_step_x[dir]][by + first_step_y[dir]] ||
+              board[0][board_b][bx + dx][by + dy]) {
+            continue;
+          }
+
+          int count = board[1][board_b][bx + dx][by + dy];
+          if (dir >= 8 && board[1][board_b][bx + first_step_x[dir]][by + first_step_y[dir]]) count++;
+          if (count == 0 && move_out_flag) {
+            continue;
+          }
+
+          if (int cx = bx + dx + first_step_x[dir], cy = by + dy + first_step_y[dir];
+              cx >= 0 && cx < 4 && cy >= 0 && cy < 4 && (board[0][board_b][cx][cy] || board[1][board_b][cx][cy])) {
+            count++;
+          }
+          if (count >= 2) {
+            continue;
+          }
+
+          valids[dir * 64 + a * 8 + b] = 1;
+        }
+      }
+    }
+
+    return valids;
+  }
+
+  void Move(ActionType action) {
+    if (action == MOVE_PASS) {
+      current_player = !current_player;
+      round += 1;
+      return;
+    }
+
+    int a = action % 64 / 8, b = pos_b_index[(round / 12) % 2][a >= 4][action % 8], dir = action / 64;
+
+    auto& piece_a = piece[current_player][a];
+    auto ax = piece_a % 4;
+    auto ay = piece_a / 4;
+    if (ax + dirx[dir] < 0 || ax + dirx[dir] >= 4 || ay + diry[dir] < 0 || ay + diry[dir] >= 4) {
+      piece_a = CAPTURED;
+    } else {
+      piece_a = (ax + dirx[dir]) + (ay + diry[dir]) * 4;
+    }
+
+    auto& piece_b = piece[current_player][b];
+    auto bx = piece_b % 4;
+    auto by = piece_b / 4;
+    if (bx + dirx[dir] < 0 || bx + dirx[dir] >= 4 || by + diry[dir] < 0 || by + diry[dir] >= 4) {
+      piece_b = CAPTURED;
+    } else {
+      piece_b = (bx + dirx[dir]) + (by + diry[dir]) * 4;
+    }
+
+    int op = (3 - b / 4) * 4;
+    for (int i = op; i < op + 4; i++) {
+      if (15 - piece[!current_player][i] == piece_b ||
+          15 - piece[!current_player][i] == (bx + first_step_x[dir]) + (by + first_step_y[dir]) * 4) {
+        auto cx = bx + first_step_x[dir] + dirx[dir];
+        auto cy = by + first_step_y[dir] + diry[dir];
+        if (cx >= 0 && cx < 4 && cy >= 0 && cy < 4) {
+          piece[!current_player][i] = 15 - cx - cy * 4;
+        } else {
+          piece[!current_player][i] = CAPTURED;
+        }
+        break;
+      }
+    }
+
+    sort4(&piece[current_player][a / 4 * 4]);
+    sort4(&piece[current_player][b / 4 * 4]);
+    sort4(&piece[!current_player][op]);
+
+    current_player = !current_player;
+    round += 1;
+  }
+
+  bool End() const {
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < 16; j += 4) {
+        if (piece[i][j] == CAPTURED && piece[i][j + 1] == CAPTURED && piece[i][j + 2] == CAPTURED &&
+            piece[i][j + 3] == CAPTURED) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  uint64_t Hash() const {
+    struct {
+      int8_t piece[2][16];
+      int8_t current_player;
+      int8_t round;
+    } key;
+    std::memcpy(key.piece, piece, sizeof(piece));
+    key.current_player = current_player;
+    key.round = round % 24;
+    return XXHash64::hash(&key, sizeof(key), 0);
+  }
+
+  void Canonicalize(float* storage) const {
+    float(&out)[25][4][4] = *reinterpret_cast<float(*)[25][4][4]>(storage);
+    float capture_count[2] = {0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+      if (piece[current_player][i] != CAPTURED) {
+        out[i][piece[current_player][i] / 4][piece[current_player][i] % 4] = 1.0f;
+        out[16 + i / 4][piece[current_player][i] / 4][piece[current_player][i] % 4] = 1.0f;
+      } else {
+        capture_count[0] += 1.0f;
+      }
+      if (piece[!current_player][i] != CAPTURED) {
+        out[20 + i / 4][piece[!current_player][i] / 4][piece[!current_player][i] % 4] = 1.0f;
+      } else {
+        capture_count[1] += 1.0f;
+      }
+    }
+    float* linear = &out[24][0][0];
+    linear[0] = (round / 12) % 2 ? 1.0f : 0.0f;
+    for (int i = 1; i < 12; i++) {
+      linear[i] = round % 12 >= i ? 1.0f : 0.0f;
+    }
+    linear[12] = capture_count[current_player];
+    linear[13] = capture_count[!current_player];
+  }
+};
+
+// a position with 0~4 pieces of each player on each board, never two on one square.
+Position random_position(std::mt19937& gen) {
+  Position position;
+  position.current_player = gen() % 2;
+  position.round = gen() % 48;
+  for (int k = 0; k < 4; k++) {
+    // squares of board k as seen by player 0, player 1 sees it as its board 3 - k.
+    int squares[16];
+    std::iota(squares, squares + 16, 0);
+    std::shuffle(squares, squares + 16, gen);
+    int count[2] = {int(gen() % 5), int(gen() % 5)};
+    for (int i = 0; i < 4; i++) {
+      position.piece[0][k * 4 + i] = i < count[0] ? squares[i] : CAPTURED;
+      position.piece[1][(3 - k) * 4 + i] = i < count[1] ? 15 - squares[4 + i] : CAPTURED;
+    }
+  }
+  for (int p = 0; p < 2; p++) {
+    for (int i = 0; i < 16; i += 4) sort4(position.piece[p] + i);
+  }
+  return position;
+}
+
+}  // namespace reference
+
+void ExpectSamePosition(const reference::Position& expected, const GameState& game) {
+  GameState from_pieces(expected.current_player, expected.round, const_cast<int8_t(*)[16]>(expected.piece));
+  ASSERT_EQ(game.ToString(), from_pieces.ToString());
+  ASSERT_EQ(game.Hash(), expected.Hash());
+  ASSERT_EQ(game.End(), expected.End());
+  ASSERT_EQ(game.Valid_moves(), expected.Valid_moves());
+
+  constexpr int size = CANONICAL_SHAPE[0] * CANONICAL_SHAPE[1] * CANONICAL_SHAPE[2];
+  std::vector<float> canonical(size), expected_canonical(size);
+  game.Canonicalize(canonical.data());
+  expected.Canonicalize(expected_canonical.data());
+  ASSERT_EQ(canonical, expected_canonical);
+}
+
+// plays both implementations side by side with random valid moves and passes.
+void ExpectSameGame(reference::Position expected, std::mt19937& gen) {
+  GameState game(expected.current_player, expected.round, expected.piece);
+  for (int turn = 0; turn < 200; turn++) {
+    ExpectSamePosition(expected, game);
+    if (::testing::Test::HasFatalFailure() || expected.End()) return;
+
+    std::vector<int> moves;
+    auto valid_moves = expected.Valid_moves();
+    for (int i = 0; i < NUM_ACTIONS; i++) {
+      if (valid_moves[i]) moves.push_back(i);
+    }
+    int action = moves.empty() || gen() % 8 == 0 ? MOVE_PASS : moves[gen() % moves.size()];
+    expected.Move(action);
+    game.Move(action);
+  }
+}
+
+TEST(GameShadow, TestBitboardsMatchPieceLists) {
+  std::mt19937 gen(2024);
+  for (int i = 0; i < 500; i++) {
+    ExpectSameGame(reference::Position{0, 0, {{0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3},
+                                               {0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3}}},
+                   gen);
+    ASSERT_FALSE(HasFatalFailure());
+  }
+  for (int i = 0; i < 5000; i++) {
+    ExpectSameGame(reference::random_position(gen), gen);
+    ASSERT_FALSE(HasFatalFailure());
+  }
+}
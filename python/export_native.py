@@ -0,0 +1,104 @@
+import argparse
+import importlib
+import struct
+
+import torch
+
+# Exports the weights of a checkpoint for the native cpu network of
+# cpp/core/util/native_nn.h.
+#
+# File layout (little endian):
+#   "SZNN", uint32 version
+#   int32 channels, height, width, extra, depth, growth, v_size, pi_size
+#   tensors, each as uint32 rank, int32 dims[rank], float32 data
+#   int32 n, then n reference inputs and the v, pi outputs of the TorchScript model
+#
+# Batch norms are folded: a batch norm followed by mish becomes a per-channel
+# scale and shift, a convolution followed by a batch norm gets its scale in the
+# weights and its shift as bias.
+
+
+def bn_fold(bn):
+    scale = bn.weight / torch.sqrt(bn.running_var + bn.eps)
+    shift = bn.bias - bn.running_mean * scale
+    return scale, shift
+
+
+def conv_bn_fold(conv, bn):
+    scale, shift = bn_fold(bn)
+    return conv.weight.flatten(1) * scale.unsqueeze(1), shift
+
+
+def write_tensor(f, t):
+    t = t.detach().float().contiguous().cpu()
+    f.write(struct.pack("<I", t.dim()))
+    f.write(struct.pack(f"<{t.dim()}i", *t.shape))
+    f.write(t.numpy().astype("<f4").tobytes())
+
+
+def write_block(f, block):
+    scale, shift = bn_fold(block.bn1)
+    write_tensor(f, scale)
+    write_tensor(f, shift)
+    w, b = conv_bn_fold(block.conv1, block.bn2)
+    write_tensor(f, w)
+    write_tensor(f, b)
+    write_tensor(f, block.conv2.weight)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Export weights for the native cpu evaluator')
+    parser.add_argument('--checkpoint', type=str, default="checkpoint.pt", help='checkpoint file')
+    parser.add_argument('--output', type=str, default="output.bin", help='output file')
+    parser.add_argument('--game', type=str, default="shadow", choices=["shadow", "connect4"], help='network of the game')
+    parser.add_argument('--reference-size', type=int, default=16, help='positions stored to validate the native network')
+    args = parser.parse_args()
+
+    arch = importlib.import_module("nnarch" if args.game == "shadow" else "nnarch_connect4")
+    extra = getattr(arch, "EXTRA_SIZE", 0)
+
+    checkpoint = torch.load(args.checkpoint, map_location="cpu")
+    net = arch.NNArch(checkpoint["args"])
+    net.load_state_dict(checkpoint["state_dict"])
+    net.eval()
+    nn_args = checkpoint["args"]
+
+    with torch.no_grad(), open(args.output, "wb") as f:
+        f.write(b"SZNN")
+        f.write(struct.pack("<I", 1))
+        f.write(struct.pack("<8i", *arch.INPUT_SIZE, extra, nn_args.depth, nn_args.num_channels,
+                            nn_args.v_size, nn_args.pi_size))
+
+        blocks = list(net.conv_layers1) + list(net.conv_layers2)
+        for i, block in enumerate(blocks):
+            write_block(f, block)
+            if i + 1 == len(net.conv_layers1):
+                scale, shift = bn_fold(net.global_pooling_bn)
+                write_tensor(f, scale)
+                write_tensor(f, shift)
+                write_tensor(f, net.global_pooling_fc.weight)
+                write_tensor(f, net.global_pooling_fc.bias)
+
+        w, b = conv_bn_fold(net.v_conv, net.v_bn)
+        write_tensor(f, w)
+        write_tensor(f, b)
+        write_tensor(f, net.v_fc1.weight)
+        write_tensor(f, net.v_fc1.bias)
+        write_tensor(f, net.v_fc2.weight)
+        write_tensor(f, net.v_fc2.bias)
+        w, b = conv_bn_fold(net.pi_conv, net.pi_bn)
+        write_tensor(f, w)
+        write_tensor(f, b)
+        write_tensor(f, net.pi_fc1.weight)
+        write_tensor(f, net.pi_fc1.bias)
+
+        # the evaluator checks its outputs against the TorchScript model on these positions.
+        traced = torch.jit.trace(net, torch.ones((1,) + arch.INPUT_SIZE))
+        reference = (torch.rand((args.reference_size,) + arch.INPUT_SIZE) < 0.3).float()
+        v, pi = traced(reference)
+        f.write(struct.pack("<i", args.reference_size))
+        write_tensor(f, reference)
+        write_tensor(f, v)
+        write_tensor(f, pi)
+
+    print(f"saved native weights to {args.output}")
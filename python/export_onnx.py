@@ -13,6 +13,8 @@ if __name__ == "__main__":
     parser.add_argument('--output', type=str, default="output.onnx", help='output file')
     parser.add_argument('--quiet', type=bool, default=False, help='quiet mode')
     parser.add_argument('--skip-check', type=bool, default=False, help='skip onnx check')
+    parser.add_argument('--check-batch-size', type=int, default=64, help='batch size used to check the dynamic batch axis')
+    parser.add_argument('--opset', type=int, default=17, help='onnx opset version')
     args = parser.parse_args()
 
     checkpoint = torch.load(args.checkpoint)
@@ -31,6 +33,7 @@ if __name__ == "__main__":
                       args.output,               # where to save the model (can be a file or file-like object)
                       export_params=True,        # store the trained parameter weights inside the model file
                       do_constant_folding=True,  # whether to execute constant folding for optimization
+                      opset_version=args.opset,  # the onnx version to export the model to
                       input_names = ['in'],      # the model's input names
                       output_names = ['v', 'p'],    # the model's output names
                       dynamic_axes={'in' : {0 : 'batch_size'},    # variable length axes
@@ -48,4 +51,15 @@ if __name__ == "__main__":
         print(f'{ort_session.get_providers()=}')
         print(f'{ort_session.get_inputs()=}')
         ort_output_v, ort_output_pi = ort_session.run(None, {"in": input.numpy()})
-        print(f'{numpy.exp(ort_output_v)=}')
\ No newline at end of file
+        print(f'{numpy.exp(ort_output_v)=}')
+
+    # the batch axis must stay dynamic, the evaluators run batches of any size.
+    if not args.skip_check:
+        ort_session = onnxruntime.InferenceSession(args.output, providers=["CPUExecutionProvider"])
+        batch_input = torch.rand((args.check_batch_size,) + INPUT_SIZE)
+        batch_v, batch_pi = net(batch_input)
+        ort_batch_v, ort_batch_pi = ort_session.run(None, {"in": batch_input.numpy()})
+        numpy.testing.assert_allclose(batch_v.detach().numpy(), ort_batch_v, rtol=1e-3, atol=1e-4)
+        numpy.testing.assert_allclose(batch_pi.detach().numpy(), ort_batch_pi, rtol=1e-3, atol=1e-4)
+        if not args.quiet:
+            print(f"batch of {args.check_batch_size} ok")
\ No newline at end of file
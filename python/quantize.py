@@ -0,0 +1,136 @@
+import argparse
+import glob
+import os
+import time
+
+import torch
+from torch import nn
+from torch.ao.quantization import get_default_qconfig_mapping, quantize_dynamic
+from torch.ao.quantization.quantize_fx import prepare_fx, convert_fx
+
+from nnarch import NNArch, NNArgs, INPUT_SIZE
+
+# Post-training INT8 quantization of the shadow network for cpu evaluators.
+#
+#   python quantize.py --checkpoint data/checkpoint/0010-shadow.pt \
+#       --dataset data/dataset/0010 --output data/checkpoint/0010-shadow_int8.pt
+#
+# static: conv and linear layers run in int8, activations are calibrated on
+#         recorded self-play positions. Mish has no int8 kernel and stays fp32.
+# dynamic: only the linear layers (most of the weights are in pi_fc1) are int8,
+#          activations are quantized on the fly. No calibration needed.
+#
+# The saved TorchScript model is loaded by QuantizedLibtorchEvaluator. An
+# accuracy-versus-throughput report against the fp32 network is printed at the
+# end, on held-out recorded positions.
+
+
+def load_positions(dataset, limit):
+    c_names = sorted(glob.glob(os.path.join(dataset, "**", "c_*_*.pt"), recursive=True))
+    if len(c_names) == 0:
+        print("Error: No recorded positions found in", dataset)
+        exit(1)
+    positions = []
+    count = 0
+    for name in c_names:
+        c = torch.load(name)
+        positions.append(c)
+        count += c.shape[0]
+        if count >= limit:
+            break
+    return torch.cat(positions)[:limit]
+
+
+def quantize_static(net, calibration, batch_size, backend):
+    prepared = prepare_fx(net, get_default_qconfig_mapping(backend), (calibration[:1],))
+    with torch.no_grad():
+        for batch in torch.split(calibration, batch_size):
+            prepared(batch)
+    return convert_fx(prepared)
+
+
+def export(net, output):
+    with torch.no_grad():
+        traced = torch.jit.trace(net, torch.ones((1,) + INPUT_SIZE))
+        traced = torch.jit.freeze(traced)
+    traced.save(output)
+
+
+def accuracy(fp32, int8, positions):
+    with torch.no_grad():
+        v32, pi32 = fp32(positions)
+        v8, pi8 = int8(positions)
+    # both networks output log-softmax
+    value_mae = (torch.exp(v32[:, 0]) - torch.exp(v8[:, 0])).abs().mean().item()
+    policy_kl = (torch.exp(pi32) * (pi32 - pi8)).sum(dim=1).mean().item()
+    top1 = (pi32.argmax(dim=1) == pi8.argmax(dim=1)).float().mean().item()
+    return value_mae, policy_kl, top1
+
+
+def throughput(net, positions, batch_size, seconds):
+    batch = positions[:batch_size]
+    with torch.no_grad():
+        net(batch)  # warm up
+        count = 0
+        start = time.perf_counter()
+        while time.perf_counter() - start < seconds:
+            net(batch)
+            count += batch.shape[0]
+    return count / (time.perf_counter() - start)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='Quantize the network to INT8 for cpu inference')
+    parser.add_argument('--checkpoint', type=str, default="checkpoint.pt", help='checkpoint file')
+    parser.add_argument('--dataset', type=str, required=True, help='folder of recorded positions (c_*_*.pt)')
+    parser.add_argument('--output', type=str, default="output_int8.pt", help='output TorchScript file')
+    parser.add_argument('--mode', type=str, default="static", choices=["static", "dynamic"], help='quantization mode')
+    parser.add_argument('--backend', type=str, default="fbgemm", choices=["fbgemm", "qnnpack"],
+                        help='quantized engine, fbgemm on x86 and qnnpack on arm')
+    parser.add_argument('--calibration-size', type=int, default=4096, help='positions used for calibration')
+    parser.add_argument('--eval-size', type=int, default=4096, help='held-out positions used for the report')
+    parser.add_argument('--batch-sizes', type=str, default="1,8,32,128", help='batch sizes of the throughput report')
+    parser.add_argument('--threads', type=int, default=1, help='intra-op threads of the throughput report')
+    parser.add_argument('--seconds', type=float, default=3.0, help='duration of each throughput measurement')
+    parser.add_argument('--skip-report', action="store_true", help='only export the model')
+    args = parser.parse_args()
+
+    torch.backends.quantized.engine = args.backend
+    torch.set_num_threads(args.threads)
+
+    checkpoint = torch.load(args.checkpoint, map_location="cpu")
+    net = NNArch(checkpoint["args"])
+    net.load_state_dict(checkpoint["state_dict"])
+    net.eval()
+
+    positions = load_positions(args.dataset, args.calibration_size + args.eval_size)
+    positions = positions[torch.randperm(positions.shape[0])]
+    calibration, held_out = positions[:args.calibration_size], positions[args.calibration_size:]
+    if held_out.shape[0] == 0:
+        print("Warning: No held-out positions, the report uses the calibration positions.")
+        held_out = calibration
+
+    if args.mode == "static":
+        qnet = quantize_static(net, calibration, 256, args.backend)
+    else:
+        qnet = quantize_dynamic(net, {nn.Linear}, dtype=torch.qint8)
+
+    export(qnet, args.output)
+    print(f"saved {args.mode} int8 model to {args.output}")
+
+    if args.skip_report:
+        exit(0)
+
+    # the report uses the exported model, as the evaluator will run it.
+    qnet = torch.jit.load(args.output)
+    value_mae, policy_kl, top1 = accuracy(net, qnet, held_out)
+    print(f"accuracy on {held_out.shape[0]} positions:")
+    print(f"  value mae      {value_mae:.5f}")
+    print(f"  policy kl      {policy_kl:.5f}")
+    print(f"  policy top-1   {top1 * 100:.2f}%")
+    print(f"throughput ({args.threads} threads, positions/s):")
+    print(f"  {'batch':>6} {'fp32':>10} {'int8':>10} {'speedup':>8}")
+    for batch_size in [int(b) for b in args.batch_sizes.split(",")]:
+        fp32 = throughput(net, held_out, batch_size, args.seconds)
+        int8 = throughput(qnet, held_out, batch_size, args.seconds)
+        print(f"  {batch_size:>6} {fp32:>10.0f} {int8:>10.0f} {int8 / fp32:>7.2f}x")
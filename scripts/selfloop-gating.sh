@@ -8,6 +8,7 @@ CHECKPOINT_PATH="./data/checkpoint"
 ELO_OUTPUT_FILE="./data/elo.txt"
 
 GATE_SCRIPT="build/gate_${GAME}"
+SERVE_SCRIPT="build/serve_${GAME}"
 TRAIN_HELPER="build/trainhelper"
 
 mkdir -p $CHECKPOINT_PATH
@@ -28,9 +29,23 @@ do
     RIGHT_MODEL_2=$CHECKPOINT_PATH/$(echo "$elo_list_by_strength" | grep -v "$base_model" | shuf -n 1 | cut -d ":" -f 1)
     RIGHT_MODEL_3=$CHECKPOINT_PATH/$(echo "$elo_list_by_strength" | grep -v "$base_model"  | head -n 8 | shuf -n 1 | cut -d ":" -f 1)
     echo "Gating between $LEFT_MODEL and ($RIGHT_MODEL, $RIGHT_MODEL_2, $RIGHT_MODEL_3)"
-    $GATE_SCRIPT $GATE_COUNT_PER_TURN $LEFT_MODEL $RIGHT_MODEL --output-data /tmp/gating_result.txt && $TRAIN_HELPER gating addresult /tmp/gating_result.txt &
-    $GATE_SCRIPT $GATE_COUNT_PER_TURN $LEFT_MODEL $RIGHT_MODEL_2 --output-data /tmp/gating_result_2.txt && $TRAIN_HELPER gating addresult /tmp/gating_result_2.txt &
-    $GATE_SCRIPT $GATE_COUNT_PER_TURN $LEFT_MODEL $RIGHT_MODEL_3 --output-data /tmp/gating_result_3.txt && $TRAIN_HELPER gating addresult /tmp/gating_result_3.txt &
-    wait
+
+    # the three gatings share one inference server, so each model is loaded once and batched across them.
+    SERVER_FLAG=""
+    if [[ -x $SERVE_SCRIPT ]]; then
+        $SERVE_SCRIPT $LEFT_MODEL $RIGHT_MODEL $RIGHT_MODEL_2 $RIGHT_MODEL_3 &
+        SERVER_PID=$!
+        SERVER_FLAG="--server"
+    fi
+
+    $GATE_SCRIPT $GATE_COUNT_PER_TURN $LEFT_MODEL $RIGHT_MODEL --output-data /tmp/gating_result.txt $SERVER_FLAG && $TRAIN_HELPER gating addresult /tmp/gating_result.txt &
+    $GATE_SCRIPT $GATE_COUNT_PER_TURN $LEFT_MODEL $RIGHT_MODEL_2 --output-data /tmp/gating_result_2.txt $SERVER_FLAG && $TRAIN_HELPER gating addresult /tmp/gating_result_2.txt &
+    $GATE_SCRIPT $GATE_COUNT_PER_TURN $LEFT_MODEL $RIGHT_MODEL_3 --output-data /tmp/gating_result_3.txt $SERVER_FLAG && $TRAIN_HELPER gating addresult /tmp/gating_result_3.txt &
+    wait $(jobs -p | grep -v "^${SERVER_PID:-x}$") || true
+
+    if [[ -n $SERVER_FLAG ]]; then
+        kill $SERVER_PID
+        wait $SERVER_PID || true
+    fi
     rm /tmp/gating_result*.txt
 done
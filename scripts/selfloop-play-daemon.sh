@@ -0,0 +1,44 @@
+# This script performs selfplay like selfloop-play.sh, with one long-running selfplay
+# process that swaps in every new best model instead of restarting for each chunk.
+
+# works in main directory
+set -e
+
+GAME=${1:?Usage: $0 <game>}
+
+CHECKPOINT_PATH="./data/checkpoint"
+DATASET_PATH="./data/dataset"
+BEST_MODEL_FILE="./data/best-model.txt"
+CURRENT_MODEL_FILE="./data/current-model.txt"
+DATASET_PER_RUN=128
+
+SELFPLAY_SCRIPT="build/selfplay_${GAME}"
+TRAIN_HELPER="build/trainhelper"
+
+mkdir -p $CHECKPOINT_PATH $DATASET_PATH
+
+$TRAIN_HELPER model pull $CHECKPOINT_PATH
+$TRAIN_HELPER model getbest $BEST_MODEL_FILE
+echo "$CHECKPOINT_PATH/$(cat $BEST_MODEL_FILE)" > $CURRENT_MODEL_FILE
+
+$SELFPLAY_SCRIPT --model $(cat $CURRENT_MODEL_FILE) --daemon $CURRENT_MODEL_FILE --output-dir $DATASET_PATH --count $DATASET_PER_RUN &
+SELFPLAY_PID=$!
+trap "kill $SELFPLAY_PID" EXIT
+
+while kill -0 $SELFPLAY_PID 2> /dev/null
+do
+    sleep 60
+
+    # the model is pulled before it is named, so the daemon never sees a partial file.
+    $TRAIN_HELPER model pull $CHECKPOINT_PATH
+    $TRAIN_HELPER model getbest $BEST_MODEL_FILE
+    echo "$CHECKPOINT_PATH/$(cat $BEST_MODEL_FILE)" > $CURRENT_MODEL_FILE.tmp
+    mv $CURRENT_MODEL_FILE.tmp $CURRENT_MODEL_FILE
+
+    for done_file in $DATASET_PATH/*/done
+    do
+        [[ -e $done_file ]] || continue
+        $TRAIN_HELPER dataset push $(dirname $done_file)
+        rm $done_file
+    done
+done